@@ -2,11 +2,29 @@
 #include "olcPixelGameEngine.h"
 #include "constants.h"
 #include "types3d.h"
+#include "imageSequence.h"
+#include "sampler.h"
+#include "span.h"
+#include "bloom.h"
+#include "workerPool.h"
+#include "shadowMap.h"
+#include "dynamicResolution.h"
+#include "frameCache.h"
+#include "decalCompositor.h"
+#include "cameraLog.h"
+#include "sceneGraph.h"
+#include "fileWatcher.h"
+#include "tokenizer.h"
+#include "triangleOrder.h"
 #include <algorithm>
 #include <map>
-#include <unordered_set>
 #include <iomanip>
+#include <array>
+#include <utility>
+#include <chrono>
+#include <future>
 #include "olcPGEX_Font-master/olcPGEX_Font.h"
+#include "textPanel.h"
 
 using namespace std;
 using namespace olc;
@@ -16,19 +34,76 @@ class Engine3D
 {
 private:
 	int screenW, screenH;
+	int renderW, renderH; //Size the 3D pass is drawn at; text and overlays are always drawn at screen size
 
 	vector<mesh> meshes;
 	vector<material> materials;
 	vector<texture> textures;
+	vector<unique_ptr<ImageSequence>> sequences;
 	vector<modifier> modifiers;
 	vector<path> paths;
 
+	//Names in the .obj that are only linked up once everything is loaded
+	struct meshLinks
+	{
+		map<string, int> meshIndices;
+		map<string, int> originMeshes; //Meshes given an origin, which info points can look at
+		vector<intPair> parents; //<mesh index, index of the mesh it is parented to>
+	};
+
+	//Scene files loaded again in the background, waiting to be swapped in between frames
+	struct sceneReload
+	{
+		bool mtl = false, mods = false, obj = false; //Which of the files were loaded again; .pth and .mdfr are loaded together
+
+		vector<material> materials;
+		vector<texture> textures;
+		vector<size_t> textureHashes;
+		vector<unique_ptr<ImageSequence>> sequences;
+		map<string, int> matIndices;
+
+		vector<modifier> modifiers;
+		vector<path> paths;
+		map<string, int> modIndices;
+		map<string, vector<intPair>> pathLookAtIndices;
+		int cameraMod = -1;
+
+		vector<mesh> meshes;
+		meshLinks links;
+	};
+
+	//What the names in the scene files were resolved to, kept so one file can be loaded again without the others
+	string sceneFile;
+	map<string, int> matIndices;
+	map<string, int> modIndices;
+	map<string, vector<intPair>> pathLookAtIndices; //<object name, {path index, infoPt index}>
+	meshLinks links;
+	vector<size_t> textureHashes; //Hash of each texture's file, so textures that haven't changed are kept when the .mtl is loaded again
+
+	//Scene files are watched while running. Whichever changes is loaded again in the background, then swapped in between frames
+	bool hotReloadEnabled = true;
+	FileWatcher watcher;
+	future<unique_ptr<sceneReload>> pendingReload;
+	bool reloadMtl = false, reloadMods = false, reloadObj = false; //Changed since the last reload started
+
+	//Meshes' triangles are put in vertex cache friendly order as they are loaded, and the average cache miss ratio before and after is printed
+	bool optimizeTriangleOrder = true;
+	const int vertexCacheSize = 16; //Vertices in the cache the order is worked out for
+
+	//Each mesh's vertices in clip space and light space, transformed once for every triangle that uses them
+	vector<vec3d> clipVerts, lightVerts;
+
+	//Each mesh's transform, relative to the mesh it is parented to if it has one
+	SceneGraph scene;
+	vector<int> modifiedMeshes; //Meshes with a modifier, whose transforms are set again every frame
+
 	mat4x4 matTrans, matCam, matView, matProj;
+	mat4x4 matViewProj; //matView then matProj, straight from world space to clip space
 
 	vec3d camPos;
 	vec3d camDir;
-	float camYaw;
-	float camTilt;
+	float camYaw = 0.0f;
+	float camTilt = 0.0f;
 	float camFOV = 100.0f;
 	bool camOverridePathLookAt = false;
 	bool debugMode = false;
@@ -36,20 +111,68 @@ private:
 	string debugText = "";
 	int cameraMod = -1;
 
-	float timePassed;
+	float timePassed; //Animation time, interpolated between simulation steps like everything else
+
+	//Paths, camera smoothing and animation time move on in fixed steps, however fast frames are drawn
+	//Frames are drawn between the last two steps, by how far the frame's time falls into the next one
+	const float simStep = 1.0f / 60.0f;
+	const int maxSimSteps = 8; //After a long stall the simulation falls behind, rather than catching up all at once
+	float simAccumulator = 0.0f;
+	float simTime = 0.0f;
+	vec3d pathLookAtTarget;
+	float prevCamYaw = 0.0f, prevCamTilt = 0.0f, prevCamFOV = 100.0f; //Camera as it was before the last step
+	float drawYaw = 0.0f, drawTilt = 0.0f, drawFOV = 100.0f; //Camera as it is drawn this frame
+
+	const cameraFrame* replayFrame = nullptr; //Recorded frame to draw next, in place of the simulation
 
 	float* depthBuffer = nullptr;
-	Pixel* bloomBuffer = nullptr;
+	Pixel* bloomBuffer = nullptr; //Emissive colour of the emissive pixels drawn this frame
+	float* bloomDepth = nullptr; //Depth each of those was drawn at, so ones drawn over afterwards can be told apart
+	Pixel* drawTarget = nullptr; //Pixels the rasterizer writes to directly; the PGE draw target, or renderBuffer below screen size
+	screenRect scissor = screenRect(0, 0, INT_MAX - 1, INT_MAX - 1); //Spans only write inside this; all of drawTarget, unless only part of the frame is being redrawn
+
+	//Draws the 3D pass at a lower resolution when it runs over budget, then scales it up to the screen
+	bool dynamicResolutionEnabled = true;
+	DynamicResolution resolution;
+	vector<Pixel> renderBuffer;
+
+	WorkerPool workers;
+	unique_ptr<Bloom> bloom;
+	int bloomStrength = 192; //Out of 256
+	bool bloomThisFrame = false; //Only if there are emissive materials
 
 	unique_ptr<Font> arial;
 	unique_ptr<Font> lato_bold;
 	unique_ptr<Font> azeret_mono;
 	unique_ptr<Font> martel_light;
+	TextPanels textPanels; //Info point text, drawn once and kept
+
+	//Draws text and other decals into the frame on the CPU, rather than leaving them for the renderer
+	bool softwareDecals = false;
+	DecalCompositor decalCompositor;
 
 	const float mipDist = 1.0f;
 	const float mipLogA = log2(mipDist);
 
-	float fogDistance = 0.01f; //Depth map is inversely scaled, with values approaching 0 at infinity
+	//Lighting baked into the vertices when a scene is loaded
+	vec3d sunDir = vec3d(0.4f, 1.0f, 0.3f); //Towards the sun
+	Pixel sunCol = Pixel(255, 240, 215);
+	Pixel ambientCol = Pixel(85, 95, 120);
+
+	//Sun shadows. Meshes that never move are drawn into the shadow map once; the rest every frame
+	bool shadowsEnabled = true;
+	ShadowMap shadows;
+
+	//Linear distance fog, in view space units. Meshes entirely past fogEnd are fully fogged, so aren't drawn at all
+	bool fogEnabled = true;
+	float fogStart = 300.0f;
+	float fogEnd = 800.0f; //The depth map is inversely scaled, so this is a depth of 1/800
+	Pixel fogCol = GREY; //Worked out from the sky by LinkScene(), so fully fogged geometry fades into what is behind it
+	span::fog fogParams;
+
+	//Background, drawn wherever no geometry has been. Without a sky material in the scene, a flat colour
+	int skyMaterial = -1;
+	Pixel skyCol = GREY;
 
 	string ReplaceCharacterInString(string input, char character, string replacement)
 	{
@@ -103,137 +226,147 @@ private:
 		return res.str();
 	}
 
+	//Loads the paths from a .pth file into "paths", and provides a <name, index> map by which these paths can be accessed
+	//Info points that look at a mesh are added to "pathLookAtIndices" under its name, to be linked once the meshes are loaded
 	bool LoadPaths(string fileName, vector<path>& paths, map<string, int>& pathIndices, map<string, vector<intPair>>& pathLookAtIndices)
 	{
-		ifstream f(fileName + ".pth");
-		if (!f.is_open())
+		Tokenizer t;
+		if (!t.Open(fileName + ".pth"))
 		{
 			return false;
 		}
 
-		string line;
 		int prevFOV = 90;
 
-		while (getline(f, line))
+		//The path, info point or text that a line adds to, which has to have been started on an earlier line
+		auto currPath = [&](const token& prefix) -> path&
 		{
-			stringstream s(line);
+			if (paths.empty())
+			{
+				t.Error("\"" + prefix.str() + "\" before any newpath");
+			}
+			return paths.back();
+		};
+		auto currInfoPt = [&](const token& prefix) -> infoPoint&
+		{
+			if (currPath(prefix).infoPts.empty())
+			{
+				t.Error("\"" + prefix.str() + "\" before any infoPt");
+			}
+			return paths.back().infoPts.back();
+		};
+		auto currText = [&](const token& prefix) -> text&
+		{
+			if (currInfoPt(prefix).texts.empty())
+			{
+				t.Error("\"" + prefix.str() + "\" before any text");
+			}
+			return paths.back().infoPts.back().texts.back();
+		};
 
-			string prefix;
-			s >> prefix;
+		while (t.NextLine())
+		{
+			token prefix = t.Word();
 
 			if (prefix == "newpath")
 			{
-				string pathName, ox, oy, oz;
-				s >> pathName >> ox >> oy >> oz;
+				string pathName = t.Word().str();
+				float ox = t.Float(), oy = t.Float(), oz = t.Float();
 
-				paths.push_back(path(pathName, stof(ox), stof(oy), stof(oz)));
+				paths.push_back(path(pathName, ox, oy, oz));
 				pathIndices.insert(pair<string, int>(pathName, paths.size() - 1));
 			}
 			else if (prefix == "v")
 			{
-				string x, y, z;
-				s >> x >> y >> z;
-				paths.back().pts.push_back(vec3d(stod(x), stod(y), stod(z)));
+				path& p = currPath(prefix);
+				float x = t.Float(), y = t.Float(), z = t.Float();
+				p.pts.push_back(vec3d(x, y, z));
 			}
 			else if (prefix == "infoPt")
 			{
-				string name, doStop;
-				s >> name >> doStop;
-
-				paths.back().infoPts.push_back(infoPoint(doStop==""?0:stoi(doStop)));
-				paths.back().infoPts.back().pathPtIndex = paths.back().pts.size()-1;
-				paths.back().infoPts.back().fov = prevFOV;
+				path& p = currPath(prefix);
+				t.Word(); //Name, only there to make the file easier to read
+				p.infoPts.push_back(infoPoint(t.Int(0)));
+				p.infoPts.back().pathPtIndex = (int)p.pts.size() - 1;
+				p.infoPts.back().fov = prevFOV;
 			}
 			else if (prefix == "look")
 			{
-				string meshName, lookPath;
-				s >> meshName >> lookPath;
-
-				map<string, vector<intPair>>::iterator it = pathLookAtIndices.find(meshName);
-				if (it != pathLookAtIndices.end()) //Mesh name is contained in pathLookAtIndices
-				{
-					it->second.push_back(intPair(paths.size() - 1, paths.back().infoPts.size() - 1));
-				}
-				else
-				{
-					pathLookAtIndices.insert(pair<string, vector<intPair>>(meshName, vector<intPair>()));
-					pathLookAtIndices.at(meshName).push_back(intPair(paths.size() - 1, paths.back().infoPts.size() - 1));
-				}
+				currInfoPt(prefix);
+				pathLookAtIndices[t.Word().str()].push_back(intPair((int)paths.size() - 1, (int)paths.back().infoPts.size() - 1));
 			}
 			else if (prefix == "fov")
 			{
-				string fov;
-				s >> fov;
-				prevFOV = stoi(fov);
-				paths.back().infoPts.back().fov = prevFOV;
+				infoPoint& ip = currInfoPt(prefix);
+				prevFOV = t.Int();
+				ip.fov = prevFOV;
 			}
 			else if (prefix == "speed") //Speed to go to next point
 			{
-				string speed;
-				s >> speed;
-				paths.back().infoPts.back().speed = stof(speed);
+				currInfoPt(prefix).speed = t.Float();
 			}
 			else if (prefix == "text")
 			{
-				string tx, ty, tz;
-				s >> tx >> ty >> tz;
-				paths.back().infoPts.back().texts.push_back(text(stof(tx), stof(ty), stof(tz)));
-			}
-			else if (prefix == "title")
-			{
-				string title = "";
-				getline(s, title);
-				if (title.size() > 1) //Remove space character at the beginning
-				{
-					title.erase(0, 1);
-				}
-				paths.back().infoPts.back().texts.back().title +=
-					(paths.back().infoPts.back().texts.back().title.length() > 0 ? "\n" : "") + title;
+				infoPoint& ip = currInfoPt(prefix);
+				float tx = t.Float(), ty = t.Float(), tz = t.Float();
+				ip.texts.push_back(text(tx, ty, tz));
 			}
-			else if (prefix == "desc")
+			else if (prefix == "title" || prefix == "desc") //Each line is added on to the ones before it
 			{
-				string desc = "";
-				getline(s, desc);
-				if (desc.size() > 1) //Remove space character at the beginning
+				text& txt = currText(prefix);
+				string& lines = prefix == "title" ? txt.title : txt.description;
+				token line = t.Rest();
+				if (!lines.empty())
 				{
-					desc.erase(0, 1);
+					lines += '\n';
 				}
-				paths.back().infoPts.back().texts.back().description +=
-					(paths.back().infoPts.back().texts.back().description.length() > 0 ? "\n" : "") + desc;
+				lines.append(line.start, line.length);
 			}
 			else if (prefix == "border")
 			{
-				string xSize, ySize;
-				s >> xSize >> ySize;
-				paths.back().infoPts.back().texts.back().borderSize = vi2d(stoi(xSize), stoi(ySize));
+				text& txt = currText(prefix);
+				int xSize = t.Int(), ySize = t.Int();
+				txt.borderSize = vi2d(xSize, ySize);
 			}
 		}
+
+		//Start each path drawn where it stands, rather than sliding there from its first point on the first frame, or after every reload
+		for (path& p : paths)
+		{
+			p.Reset();
+		}
+		return true;
 	}
 
-	bool LoadModifiers(string fileName, vector<modifier>& modifiers, map<string, int>& modIndices, vector<path>& paths, map<string, vector<intPair>>& pathLookAtIndices)
+	//Loads the modifiers from a .mdfr file into "modifiers", and provides a <name, index> map by which these modifiers can be accessed
+	//The paths they follow are loaded from the .pth file first
+	bool LoadModifiers(string fileName, vector<modifier>& modifiers, map<string, int>& modIndices, vector<path>& paths, map<string, vector<intPair>>& pathLookAtIndices, int& cameraMod)
 	{
-		ifstream f(fileName + ".mdfr");
-		if (!f.is_open())
+		Tokenizer t;
+		if (!t.Open(fileName + ".mdfr"))
 		{
 			return false;
 		}
 
 		map<string, int> pathIndices;
-		bool usePaths = LoadPaths(fileName, paths, pathIndices, pathLookAtIndices);
-
-		string line;
+		LoadPaths(fileName, paths, pathIndices, pathLookAtIndices);
 
-		while (getline(f, line))
+		auto currMod = [&](const token& prefix) -> modifier&
 		{
-			stringstream s(line);
+			if (modifiers.empty())
+			{
+				t.Error("\"" + prefix.str() + "\" before any newmod");
+			}
+			return modifiers.back();
+		};
 
-			string prefix;
-			s >> prefix;
+		while (t.NextLine())
+		{
+			token prefix = t.Word();
 
 			if (prefix == "newmod") //Modifier
 			{
-				string modName;
-				s >> modName;
+				string modName = t.Word().str();
  
 				modifiers.push_back(modifier());
 				modIndices.insert(pair<string, int>(modName, modifiers.size()-1));
@@ -251,98 +384,66 @@ private:
 
 			else if (prefix == "billboard")
 			{
-				string value;
-				s >> value;
-
-				modifiers.back().isBillboard = stoi(value);
+				currMod(prefix).isBillboard = t.Int();
 			}
 
 			else if (prefix == "rot")
 			{
-				string rx, ry, rz;
-				s >> rx >> ry >> rz;
-				modifiers.back().constantRotation = vec3d(stod(rx), stod(ry), stod(rz));
+				modifier& mod = currMod(prefix);
+				float rx = t.Float(), ry = t.Float(), rz = t.Float();
+				mod.constantRotation = vec3d(rx, ry, rz);
 			}
 
+			//path <path name> <steps per second> <loop> <use transform as offset> <reverse> <apply rotation>
 			else if (prefix == "path")
 			{
-				string pathName, stepsPerSecond, loop = "0", useTransformAsPathOffset = "0", pathReverse = "0", applyRotation = "1";
-				s >> pathName >> stepsPerSecond >> loop >> useTransformAsPathOffset >> pathReverse >> applyRotation;
+				modifier& mod = currMod(prefix);
+				token pathName = t.Word();
+				map<string, int>::const_iterator it = pathIndices.find(pathName.str());
+				if (it == pathIndices.end())
+				{
+					t.Error("no path called \"" + pathName.str() + "\" in " + fileName + ".pth");
+				}
 
-				modifiers.back().pathIndex = pathIndices.at(pathName);
-				modifiers.back().pathStepsPerSecond = stof(stepsPerSecond);
-				modifiers.back().useTransformAsPathOffset = stoi(useTransformAsPathOffset);
-				modifiers.back().pathReverse = stoi(pathReverse);
-				modifiers.back().applyPathRotation = stoi(applyRotation);
+				mod.pathIndex = it->second;
+				mod.pathStepsPerSecond = t.Float();
+				t.Int(0); //Loop; paths always loop
+				mod.useTransformAsPathOffset = t.Int(0);
+				mod.pathReverse = t.Int(0);
+				mod.applyPathRotation = t.Int(1);
 			}
 		}
+
+		return true;
 	}
 
-	//Loads the textures from a .mtl file into "textures", and provides a <name, index> map by which these textures can be accessed
-	//Returns true if there is at least one texture that was successfully loaded into the textures vector
-	bool LoadTextures(string fileName, vector<texture>& textures, map<string, int>& texIndices)
+	//Index of the texture loaded from a file, loading it the first time it is asked for
+	//Textures whose files hash the same as one in "keep" are taken from there rather than decoded again
+	int TextureIndex(const string& texFileName, vector<texture>& textures, map<string, int>& texIndices, vector<size_t>& texHashes, const map<size_t, texture>& keep)
 	{
-		ifstream f(fileName + ".mtl");
-		if (!f.is_open()) //If no file, create default blank texture
-		{
-			return false;
-		}
-
-		unordered_set<string> texFileNames; //Ensures no duplicate textures /////BUG: Unordered set causes RoadTile to appear in ocean animation
-
-		string line;
-
-		//Get unique texture file names
-		while (getline(f, line))
-		{
-			stringstream s(line);
-
-			string prefix;
-			s >> prefix;
-
-			//Diffuse texture and alpha texture
-			if (prefix == "map_Kd" || prefix == "map_d")
-			{
-				string texFileName;
-				s >> texFileName;
-
-				texFileNames.insert(texFileName);
-			}
-			if (prefix == "animap_Kd")
-			{
-				string trash, texFileName;
-				s >> trash >> trash >> trash >> trash >> trash >> texFileName;
-				texFileNames.insert(texFileName);
-			}
-		}
-
-		if (texFileNames.size() == 0)
-		{
-			//If no textures, return false
-			return false;
-		}
-		else
+		map<string, int>::const_iterator it = texIndices.find(texFileName);
+		if (it != texIndices.end())
 		{
-			//Load textures by file name
-			for (const auto& fn : texFileNames)
-			{
-				textures.push_back(texture(new Sprite(fn))); //Textures automatically generates its own mips
-				texIndices.insert(pair<string, int>(fn, textures.size()-1));
-			}
+			return it->second;
 		}
-		f.close();
 
-		return true;
+		size_t texHash = HashFileContents(texFileName);
+		map<size_t, texture>::const_iterator kept = keep.find(texHash);
+		textures.push_back(kept != keep.end() ? kept->second : texture(new Sprite(texFileName))); //Textures automatically generates its own mips
+		texHashes.push_back(texHash);
+		texIndices.insert(pair<string, int>(texFileName, textures.size() - 1));
+		return (int)textures.size() - 1;
 	}
 
 	//Loads the materials from a .mtl file into "materials", and provides a <name, index> map by which these materials can be accessed
-	bool LoadMaterials(string fileName, vector<material>& materials, map<string, int>& matIndices, vector<texture>& textures)
+	//Their textures are loaded into "textures" as they come up, each file only once
+	bool LoadMaterials(string fileName, vector<material>& materials, map<string, int>& matIndices, vector<texture>& textures,
+					   vector<size_t>& texHashes, vector<unique_ptr<ImageSequence>>& sequences, const map<size_t, texture>& keep)
 	{
 		map<string, int> texIndices;
-		bool useTexs = LoadTextures(fileName, textures, texIndices);
 
-		ifstream f(fileName + ".mtl");
-		if(!f.is_open())
+		Tokenizer t;
+		if (!t.Open(fileName + ".mtl"))
 		{
 			//If fails, create the default material which all objects will use
 			materials = { material() };
@@ -350,18 +451,22 @@ private:
 			return false;
 		}
 
-		string line;
-		while (getline(f, line))
+		auto currMat = [&](const token& prefix) -> material&
 		{
-			stringstream s(line);
+			if (materials.empty())
+			{
+				t.Error("\"" + prefix.str() + "\" before any newmtl");
+			}
+			return materials.back();
+		};
 
-			string prefix;
-			s >> prefix;
+		while (t.NextLine())
+		{
+			token prefix = t.Word();
 
 			if (prefix == "newmtl") //Material
 			{
-				string matName;
-				s >> matName;
+				string matName = t.Word().str();
  
 				materials.push_back(material());
 				matIndices.insert(pair<string, int>(matName, materials.size()-1));
@@ -369,84 +474,299 @@ private:
 
 			else if (prefix == "Kd") //Diffuse color
 			{
-				string r, g, b;
-				s >> r >> g >> b;
-				materials.back().col = PixelF(stof(r), stof(g), stof(b));
+				material& mat = currMat(prefix);
+				float r = t.Float(), g = t.Float(), b = t.Float();
+				mat.col = PixelF(r, g, b);
+			}
+
+			else if (prefix == "illum") //Illumination model; only 0 (color, no lighting) is treated specially
+			{
+				currMat(prefix).lit = t.Word() != "0";
+			}
+
+			else if (prefix == "Ke") //Emissive color
+			{
+				material& mat = currMat(prefix);
+				float r = t.Float(), g = t.Float(), b = t.Float();
+				mat.emis = PixelF(r, g, b);
 			}
 
 			else if (prefix == "map_Kd") //Diffuse texture
 			{
-				string texFileName, mipScale;
-				s >> texFileName >> mipScale;
-				materials.back().textureIndex = useTexs ? texIndices[texFileName] : -1;
-				if (mipScale != "")
-				{
-					materials.back().mipScale = stof(mipScale);
-				}
+				material& mat = currMat(prefix);
+				mat.textureIndex = TextureIndex(t.Word().str(), textures, texIndices, texHashes, keep);
+				mat.mipScale = t.Float(mat.mipScale);
 			}
 
+			//animap_Kd <x divisions> <y divisions> <first index> <last index> <animation fps> <texture file> <mip scale>
 			else if (prefix == "animap_Kd") //Animated diffuse texture
 			{
-				string xDivisions, yDivisions, startIndex, endIndex, animFps, texFileName, mipScale;
-				s >> xDivisions >> yDivisions >> startIndex >> endIndex >> animFps >> texFileName >> mipScale;
+				material& mat = currMat(prefix);
+				mat.xDivisions = t.Int();
+				mat.yDivisions = t.Int();
+				mat.startIndex = t.Int();
+				mat.endIndex   = t.Int();
+				mat.animSpeed  = t.Float();
+				mat.textureIndex = TextureIndex(t.Word().str(), textures, texIndices, texHashes, keep);
+				mat.mipScale = t.Float(mat.mipScale);
+			}
+
+			//animseq_Kd <start frame> <end frame> <fps> <frames in memory> <file pattern, e.g. Ocean\\Foam\\foam_####.exr> <mip scale>
+			else if (prefix == "animseq_Kd") //Streamed image sequence diffuse texture
+			{
+				material& mat = currMat(prefix);
+				int startFrame = t.Int(), endFrame = t.Int();
+				float animFps = t.Float();
+				int ringSize = t.Int();
+				string pattern = t.Word().str();
+
+				sequences.push_back(make_unique<ImageSequence>(pattern, startFrame, endFrame, animFps, ringSize));
+				mat.sequenceIndex = (int)sequences.size() - 1;
+				mat.mipScale = t.Float(mat.mipScale);
+			}
+
+			//filter_Kd <nearest|bilinear>
+			else if (prefix == "filter_Kd") //Texture filtering
+			{
+				currMat(prefix).filter = t.Word() == "bilinear" ? textureFilter::BILINEAR : textureFilter::NEAREST;
+			}
+
+			//alpha_d <auto|blend|cutout>
+			else if (prefix == "alpha_d") //How map_d transparency is drawn; auto uses cut-outs for textures that are (nearly) all solid or clear
+			{
+				token mode = t.Word();
+				currMat(prefix).transparency = mode == "blend" ? alphaMode::BLEND : mode == "cutout" ? alphaMode::CUTOUT : alphaMode::AUTO;
+			}
+
+			else if (prefix == "nofog") //Not faded by distance fog
+			{
+				currMat(prefix).fog = false;
+			}
+
+			else if (prefix == "sky") //Background, as an equirectangular map_Kd. Meshes using it aren't drawn
+			{
+				currMat(prefix).sky = true;
+			}
+
+			else if (prefix == "map_d")
+			{
+				material& mat = currMat(prefix);
+				mat.alphaIndex = TextureIndex(t.Word().str(), textures, texIndices, texHashes, keep);
+				mat.mipScale = t.Float(mat.mipScale);
+			}
+		}
+
+		return true;
+	}
+
+	//Sun and ambient light at each vertex, from its normal (or the face normal, for faces without any)
+	//Baked in the mesh's own space, so it turns with the mesh
+	void BakeLighting(mesh& m)
+	{
+		vec3d toSun = sunDir.normalized();
+
+		for (triangle& tri : m.tris)
+		{
+			vec3d faceNormal = (tri.p[1] - tri.p[0]).cross(tri.p[2] - tri.p[0]).normalized();
+
+			for (int v = 0; v < 3; v++)
+			{
+				vec3d n = tri.vn[v].length() > 0.0f ? tri.vn[v].normalized() : faceNormal;
+				float sun = fmax(0.0f, n.dot(toSun));
+
+				tri.light[v] = Pixel(min(255, (int)(ambientCol.r + sunCol.r * sun)),
+									 min(255, (int)(ambientCol.g + sunCol.g * sun)),
+									 min(255, (int)(ambientCol.b + sunCol.b * sun)));
+			}
+		}
+	}
+
+	//Draws every static mesh into the shadow map, fitting the map around them
+	void DrawStaticShadows()
+	{
+		vector<triangle> casters;
+		vec3d boundsMin(INFINITY, INFINITY, INFINITY), boundsMax(-INFINITY, -INFINITY, -INFINITY);
+
+		for (int i = 0; i < (int)meshes.size(); i++)
+		{
+			mesh& m = meshes[i];
+			if (m.moves)
+			{
+				continue;
+			}
+
+			const mat4x4& matMesh = scene.World(i);
+
+			for (const triangle& tri : m.tris)
+			{
+				if (!materials[tri.matIndex].lit) //e.g. the skybox
+				{
+					continue;
+				}
 
-				materials.back().textureIndex = texIndices.at(texFileName);
-				materials.back().xDivisions = stoi(xDivisions);
-				materials.back().yDivisions = stoi(yDivisions);
-				materials.back().startIndex = stoi(startIndex);
-				materials.back().endIndex   = stoi(endIndex);
-				materials.back().animSpeed  = stof(animFps);
-				if (mipScale != "")
+				triangle caster;
+				TransformPoints(tri.p, caster.p, 3, matMesh);
+				for (int v = 0; v < 3; v++)
 				{
-					materials.back().mipScale = stof(mipScale);
+					boundsMin = vec3d(fmin(boundsMin.x, caster.p[v].x), fmin(boundsMin.y, caster.p[v].y), fmin(boundsMin.z, caster.p[v].z));
+					boundsMax = vec3d(fmax(boundsMax.x, caster.p[v].x), fmax(boundsMax.y, caster.p[v].y), fmax(boundsMax.z, caster.p[v].z));
 				}
+				casters.push_back(caster);
 			}
+		}
 
-			else if (prefix == "map_d")
+		if (casters.empty())
+		{
+			boundsMin = boundsMax = vec3d();
+		}
+
+		shadows.BeginStatic(sunDir, boundsMin, boundsMax);
+		for (triangle& caster : casters)
+		{
+			shadows.DrawStatic(caster.p[0], caster.p[1], caster.p[2]);
+		}
+		shadows.EndStatic();
+	}
+
+	//Sets the local transforms of meshes with modifiers, then brings every world transform that changed up to date
+	void UpdateTransforms()
+	{
+		vec3d upVec = { 0, 1, 0 };
+
+		for (int i : modifiedMeshes)
+		{
+			mesh& m = meshes[i];
+			modifier& mod = modifiers[m.modifier];
+
+			vec3d dpos = m.position;
+
+			//CONSTANT ROTATION
+			quaternion rot = RotationQuaternion(m.rotation + mod.constantRotation * timePassed);
+
+			//FOLLOW PATH
+			if (mod.pathIndex != -1)
 			{
-				string alphaFileName, mipScale;
-				s >> alphaFileName >> mipScale;
-				materials.back().alphaIndex = useTexs ? texIndices[alphaFileName] : -1;
-				if (mipScale != "")
+				if (mod.useTransformAsPathOffset)
+				{
+					dpos += paths[mod.pathIndex].getCurrPosition();
+				}
+				else
 				{
-					materials.back().mipScale = stof(mipScale);
+					vec3d tangent;
+					vec3d pathPos = paths[mod.pathIndex].getCurrPosition(0.0f, &tangent);
+					m.setPos(pathPos);
+					dpos = pathPos;
+
+					if (mod.applyPathRotation)
+					{
+						//Face along the path; where it has no direction (a single point, or points on top of each other), keep facing the last way it had
+						vec3d forward = tangent * -1.0f;
+						if (forward.length() > 1e-6f)
+						{
+							m.pathRotation = quaternion::fromMatrix(PointAtMatrix(vec3d(), forward, upVec)) * quaternion(vec3d(0, 1, 0), -PI);
+						}
+						rot = m.pathRotation * rot;
+					}
 				}
 			}
+
+
+			//BILLBOARD
+			if (mod.isBillboard)
+			{
+				vec3d forward = m.position - camPos + camDir;
+				rot = quaternion::fromMatrix(PointAtMatrix(vec3d(), forward, upVec)) * rot;
+			}
+
+			//Vertices are origin-based, centered at <0, 0, 0>, so only translate them at the end, after all the rotations
+			scene.SetLocal(i, RotationTranslationMatrix(rot, dpos));
 		}
-		f.close();
 
-		return true;
+		scene.Update();
 	}
 
 	//Loads all assets from a .obj file and its corresponding .mtl file, including meshes, materials, and textures
 	bool LoadFromObjectFile(string fileName, vector<mesh>& meshes, vector<material>& materials, vector<texture>& textures, vector<modifier>& modifiers, vector<path>& paths)
 	{
-		ifstream f(fileName + ".obj");
-		if(!f.is_open())
+		if (!ifstream(fileName + ".obj").is_open())
 		{
 			return false;
 		}
 
-		meshes = vector<mesh>();
-		materials = vector<material>();
-		textures = vector<texture>();
-		modifiers = vector<modifier>();
+		auto clear = [&]()
+		{
+			meshes = vector<mesh>();
+			materials = vector<material>();
+			textures = vector<texture>();
+			textureHashes.clear();
+			sequences.clear();
+			modifiers = vector<modifier>();
+			paths = vector<path>();
+			cameraMod = -1;
+			matIndices.clear();
+			modIndices.clear();
+			pathLookAtIndices.clear();
+			links = meshLinks();
+			textPanels.Clear();
+		};
+		clear();
 
-		map<string, int> matIndices;
-		bool useMats = LoadMaterials(fileName, materials, matIndices, textures);
+		bool loaded = true;
+		try
+		{
+			LoadMaterials(fileName, materials, matIndices, textures, textureHashes, sequences, map<size_t, texture>());
+			LoadModifiers(fileName, modifiers, modIndices, paths, pathLookAtIndices, cameraMod);
+			LoadMeshes(fileName, meshes, matIndices, modIndices, links);
+		}
+		catch (const exception& e) //Start with nothing rather than half a scene
+		{
+			printf("Couldn't load %s: %s\n", fileName.c_str(), e.what());
+			clear();
+			loaded = false;
+		}
+		LinkScene();
 
-		map<string, int> modIndices;
-		map<string, vector<intPair>> pathLookAtIndices; //<object name, {path index, infoPt index}>
-		bool useMods = LoadModifiers(fileName, modifiers, modIndices, paths, pathLookAtIndices);
+		return loaded;
+	}
+
+	//Loads the meshes from a .obj file, with their lighting baked. Materials and modifiers are looked up by name in the given maps
+	//Only touches what it is given, so it can run in the background
+	bool LoadMeshes(string fileName, vector<mesh>& meshes, const map<string, int>& matIndices, const map<string, int>& modIndices, meshLinks& links)
+	{
+		ifstream f(fileName + ".obj");
+		if(!f.is_open())
+		{
+			return false;
+		}
 
 		vector<vec3d> vts;
 		vector<vec2d> uvs;
 		vector<vec3d> vns;
 		int matIndex = 0; //There will always be at least one material in the materials vector, the default solid white material
+		map<int, int> meshVerts; //<index into vts, index into the current mesh's verts>
 		string line;
+		int lineNumber = 0;
+
+		//Parents can come later in the file than their children, so they are looked up once it has all been read
+		struct parentName
+		{
+			int mesh, line;
+			string name;
+		};
+		vector<parentName> parentNames;
+
+		auto currMesh = [&](const string& prefix) -> mesh&
+		{
+			if (meshes.empty())
+			{
+				throw parseError(fileName + ".obj", lineNumber, "\"" + prefix + "\" before any o");
+			}
+			return meshes.back();
+		};
 
 		while (getline(f, line)) //Loop through lines
 		{
+			lineNumber++;
 			if (line == "")
 			{
 				continue;
@@ -462,18 +782,12 @@ private:
 				string meshName, ox, oy, oz;
 				s >> meshName >> ox >> oy >> oz;
 				meshes.push_back(mesh(meshName));
+				meshVerts.clear();
+				links.meshIndices[meshName] = (int)meshes.size() - 1;
 				if (ox != "") //Origin specified
 				{
 					meshes.back().position = vec3d(stod(ox), stod(oy), stod(oz));
-
-					map<string, vector<intPair>>::iterator it = pathLookAtIndices.find(meshName);
-					if (it != pathLookAtIndices.end()) //Mesh name is contained in pathLookAtIndices
-					{
-						for (intPair ip : it->second)
-						{
-							paths[ip.a].infoPts[ip.b].lookMeshIndex = meshes.size() - 1;
-						}
-					}
+					links.originMeshes[meshName] = (int)meshes.size() - 1;
 				}
 				if (meshName.length() >= 2 && meshName[1] == '_') //TODO: REMOVE
 				{
@@ -490,7 +804,15 @@ private:
 			{
 				string modName;
 				s >> modName;
-				meshes.back().modifier = modIndices.at(modName);
+				currMesh(prefix).modifier = modIndices.at(modName);
+			}
+
+			else if (prefix == "parent") //Parent mesh; this mesh's origin and rotation are then relative to it, and it moves with it
+			{
+				string parentName;
+				s >> parentName;
+				currMesh(prefix);
+				parentNames.push_back({ (int)meshes.size() - 1, lineNumber, parentName });
 			}
 
 			else if (prefix == "v") //Vertex
@@ -523,6 +845,7 @@ private:
 
 			else if (prefix == "f") //Face
 			{
+				mesh& m = currMesh(prefix);
 				int vals[3][3]; //[0][x] = vertices
 								//[1][x] = uvs
 								//[2][x] = vertex norms
@@ -547,14 +870,14 @@ private:
 				switch (j)
 				{
 					case 1: //Just vertices
-						meshes.back().tris.push_back(triangle(
+						m.tris.push_back(triangle(
 																matIndex,
 																vts[vals[0][0] - 1], vts[vals[0][1] - 1], vts[vals[0][2] - 1])
 															 );
 						break;
 
 					case 2: //Vertices and UVs
-						meshes.back().tris.push_back(triangle(
+						m.tris.push_back(triangle(
 																matIndex,
 																vts[vals[0][0] - 1], vts[vals[0][1] - 1], vts[vals[0][2] - 1],
 																uvs[vals[1][0] - 1], uvs[vals[1][1] - 1], uvs[vals[1][2] - 1])
@@ -562,7 +885,7 @@ private:
 						break;
 
 					case 3: //Vertices, UVs, and Vertex normals
-						meshes.back().tris.push_back(triangle(
+						m.tris.push_back(triangle(
 																matIndex,
 																vts[vals[0][0] - 1], vts[vals[0][1] - 1], vts[vals[0][2] - 1],
 																uvs[vals[1][0] - 1], uvs[vals[1][1] - 1], uvs[vals[1][2] - 1],
@@ -570,16 +893,266 @@ private:
 															 );
 						break;
 				}
+
+				for (int i = 0; i < 3; i++)
+				{
+					int newVert = (int)m.verts.size();
+					map<int, int>::iterator it = meshVerts.insert(pair<int, int>(vals[0][i] - 1, newVert)).first;
+					if (it->second == newVert)
+					{
+						m.verts.push_back(vts[vals[0][i] - 1]);
+					}
+					m.indices.push_back(it->second);
+				}
 			}
 		}
 		f.close();
 
+		for (const parentName& pn : parentNames)
+		{
+			map<string, int>::const_iterator it = links.meshIndices.find(pn.name);
+			if (it == links.meshIndices.end())
+			{
+				throw parseError(fileName + ".obj", pn.line, "no mesh called \"" + pn.name + "\" to parent to");
+			}
+			links.parents.push_back(intPair(pn.mesh, it->second));
+		}
+
+		int numTris = 0;
+		float missesBefore = 0.0f, missesAfter = 0.0f;
+		for (mesh& m : meshes)
+		{
+			BakeLighting(m);
+			m.calculateBounds();
+
+			if (optimizeTriangleOrder)
+			{
+				float before, after;
+				OptimizeTriangleOrder(m, vertexCacheSize, before, after);
+				int meshTris = (int)m.tris.size();
+				numTris += meshTris;
+				missesBefore += before * meshTris;
+				missesAfter += after * meshTris;
+			}
+		}
+		if (numTris > 0)
+		{
+			printf("Reordered %d triangles: average cache miss ratio %.3f before, %.3f after\n", numTris, missesBefore / numTris, missesAfter / numTris);
+		}
+
 		return true;
 	}
 
-	mat4x4 CalculateProjectionMatrix(float zNear, float zFar, float fov, float screenWidth, float screenHeight)
+	//Links up everything that refers across the scene files: info points looking at meshes, parent meshes,
+	//and the flags that depend on which materials and modifiers meshes use. Run after any of the files are loaded
+	void LinkScene()
 	{
-		mat4x4 res;
+		for (path& p : paths)
+		{
+			for (infoPoint& ip : p.infoPts)
+			{
+				ip.lookMeshIndex = -1;
+			}
+		}
+		for (const pair<const string, vector<intPair>>& look : pathLookAtIndices)
+		{
+			map<string, int>::const_iterator it = links.originMeshes.find(look.first);
+			if (it != links.originMeshes.end()) //Mesh name is contained in pathLookAtIndices
+			{
+				for (intPair ip : look.second)
+				{
+					paths[ip.a].infoPts[ip.b].lookMeshIndex = it->second;
+				}
+			}
+		}
+
+		scene.Resize((int)meshes.size());
+		for (intPair parent : links.parents)
+		{
+			scene.SetParent(parent.a, parent.b); //Ignored if it would make a loop
+		}
+
+		modifiedMeshes.clear();
+		for (int i = 0; i < (int)meshes.size(); i++)
+		{
+			mesh& m = meshes[i];
+			scene.SetLocal(i, MeshMatrix(m));
+			if (m.modifier != -1)
+			{
+				modifiedMeshes.push_back(i);
+			}
+
+			m.moves = false;
+			for (int p = i; p != -1 && !m.moves; p = scene.Parent(p))
+			{
+				m.moves = meshes[p].modifier != -1;
+			}
+		}
+		scene.Update();
+
+		for (mesh& m : meshes)
+		{
+			m.fogCullable = true;
+			m.sky = !m.tris.empty();
+			for (triangle& tri : m.tris)
+			{
+				m.fogCullable &= materials[tri.matIndex].fog;
+				m.sky &= materials[tri.matIndex].sky;
+			}
+		}
+
+		skyMaterial = -1;
+		for (int i = 0; i < (int)materials.size(); i++)
+		{
+			if (materials[i].sky)
+			{
+				skyMaterial = i;
+			}
+		}
+		fogCol = SkyHorizonColour();
+
+		shadows.Invalidate();
+		cache = frameCache();
+	}
+
+	//For each index in the old name map, the index of the same name in the new one, or "missing" if it is gone
+	static vector<int> RemapByName(const map<string, int>& oldIndices, const map<string, int>& newIndices, int count, int missing)
+	{
+		vector<int> remap(count, missing);
+		for (const pair<const string, int>& old : oldIndices)
+		{
+			map<string, int>::const_iterator it = newIndices.find(old.first);
+			if (it != newIndices.end())
+			{
+				remap[old.second] = it->second;
+			}
+		}
+		return remap;
+	}
+
+	//Loads whichever scene files have changed in the background, unless that is already happening
+	void StartReload()
+	{
+		if (pendingReload.valid() || !(reloadMtl || reloadMods || reloadObj))
+		{
+			return;
+		}
+
+		//Copies of everything the loading reads, so it never touches what frames are being drawn from
+		bool mtl = reloadMtl, mods = reloadMods, obj = reloadObj;
+		string file = sceneFile;
+		map<string, int> mats = matIndices, mdfrs = modIndices;
+		map<size_t, texture> keep;
+		for (int i = 0; i < (int)textures.size(); i++)
+		{
+			keep[textureHashes[i]] = textures[i];
+		}
+		reloadMtl = reloadMods = reloadObj = false;
+
+		pendingReload = async(launch::async, [this, mtl, mods, obj, file, mats, mdfrs, keep]()
+		{
+			unique_ptr<sceneReload> r = make_unique<sceneReload>();
+			r->mtl = mtl;
+			r->mods = mods;
+			r->obj = obj;
+			if (mtl)
+			{
+				LoadMaterials(file, r->materials, r->matIndices, r->textures, r->textureHashes, r->sequences, keep);
+			}
+			if (mods)
+			{
+				LoadModifiers(file, r->modifiers, r->modIndices, r->paths, r->pathLookAtIndices, r->cameraMod);
+			}
+			if (obj)
+			{
+				LoadMeshes(file, r->meshes, mtl ? r->matIndices : mats, mods ? r->modIndices : mdfrs, r->links);
+			}
+			return r;
+		});
+	}
+
+	//Swaps in scene files that have finished loading again. Meshes that weren't loaded again are pointed at the new materials and modifiers of the same names
+	void SwapReload(sceneReload& r)
+	{
+		if (r.mtl)
+		{
+			if (!r.obj)
+			{
+				vector<int> remap = RemapByName(matIndices, r.matIndices, (int)materials.size(), 0);
+				for (mesh& m : meshes)
+				{
+					for (triangle& tri : m.tris)
+					{
+						tri.matIndex = remap[tri.matIndex];
+					}
+				}
+			}
+
+			materials = move(r.materials);
+			textures = move(r.textures);
+			textureHashes = move(r.textureHashes);
+			sequences = move(r.sequences);
+			matIndices = move(r.matIndices);
+		}
+
+		if (r.mods)
+		{
+			if (!r.obj)
+			{
+				vector<int> remap = RemapByName(modIndices, r.modIndices, (int)modifiers.size(), -1);
+				for (mesh& m : meshes)
+				{
+					m.modifier = m.modifier != -1 ? remap[m.modifier] : -1;
+				}
+			}
+
+			modifiers = move(r.modifiers);
+			paths = move(r.paths);
+			modIndices = move(r.modIndices);
+			pathLookAtIndices = move(r.pathLookAtIndices);
+			cameraMod = r.cameraMod;
+		}
+
+		if (r.obj)
+		{
+			meshes = move(r.meshes);
+			links = move(r.links);
+		}
+
+		LinkScene();
+	}
+
+	//Notes which scene files have changed, swaps in any that have finished loading again, and starts loading the rest
+	void UpdateHotReload()
+	{
+		for (const string& fn : watcher.Changed())
+		{
+			string ext = fn.substr(fn.find_last_of('.') + 1);
+			reloadMtl |= ext == "mtl";
+			reloadMods |= ext == "mdfr" || ext == "pth";
+			reloadObj |= ext == "obj";
+		}
+
+		if (pendingReload.valid() && pendingReload.wait_for(chrono::seconds(0)) == future_status::ready)
+		{
+			try
+			{
+				unique_ptr<sceneReload> r = pendingReload.get();
+				SwapReload(*r);
+				printf("Reloaded%s%s%s\n", r->mtl ? " materials" : "", r->mods ? " modifiers and paths" : "", r->obj ? " meshes" : "");
+			}
+			catch (const exception& e) //Most likely saved half way through editing; the scene stays as it was
+			{
+				printf("Couldn't reload %s: %s\n", sceneFile.c_str(), e.what());
+			}
+		}
+
+		StartReload();
+	}
+
+	mat4x4 CalculateProjectionMatrix(float zNear, float zFar, float fov, float screenWidth, float screenHeight)
+	{
+		mat4x4 res;
 
 		float aspectRatio = screenHeight / screenWidth;
 		float fovRad = 1.0f / tanf(fov / 360.0f * 3.1415926535898f);
@@ -643,6 +1216,37 @@ private:
 
 		return res;
 	}
+	//Same turn as CalculateRotationXMatrix(rot.x), then the Y and Z matrices, including the X matrix only turning by half theta
+	quaternion RotationQuaternion(const vec3d& rot)
+	{
+		return quaternion(vec3d(0, 0, 1), rot.z) * quaternion(vec3d(0, 1, 0), -rot.y) * quaternion(vec3d(1, 0, 0), rot.x * 0.5f);
+	}
+	//Camera's turn, tilting then turning to face yaw
+	quaternion CameraRotation(float yaw, float tilt)
+	{
+		return RotationQuaternion(vec3d(tilt, yaw, 0.0f));
+	}
+	//Yaw and tilt of a camera turn, from the direction it faces. Any roll is dropped
+	void CameraAngles(const quaternion& rot, float& yaw, float& tilt)
+	{
+		vec3d dir = rot.rotate(vec3d(0, 0, 1));
+		tilt = 2.0f * asinf(fmax(-1.0f, fmin(1.0f, -dir.y)));
+		yaw = atan2f(-dir.x, dir.z);
+	}
+	//Turn, then move to pos; the same as the turn's matrix followed by CalculateTranslationMatrix()
+	mat4x4 RotationTranslationMatrix(const quaternion& rot, const vec3d& pos)
+	{
+		mat4x4 res = rot.toMatrix();
+		res.m[3][0] = pos.x;
+		res.m[3][1] = pos.y;
+		res.m[3][2] = pos.z;
+		return res;
+	}
+	//Transform of a mesh without a modifier: its rotation, then its origin
+	mat4x4 MeshMatrix(const mesh& m)
+	{
+		return RotationTranslationMatrix(RotationQuaternion(m.rotation), m.position);
+	}
 	mat4x4 CalculateTranslationMatrix(float x, float y, float z)
 	{
 		mat4x4 res;
@@ -750,6 +1354,10 @@ private:
 		vec3d* outsidePts[3];
 		vec2d* insideTex[3];
 		vec2d* outsideTex[3];
+		Pixel* insideLight[3];
+		Pixel* outsideLight[3];
+		vec3d* insideShadow[3];
+		vec3d* outsideShadow[3];
 		int insidePtCount = 0, insideTexCount = 0;
 		int outsidePtCount = 0, outsideTexCount = 0;
 
@@ -762,11 +1370,15 @@ private:
 			if (ds[i] >= 0)
 			{
 				insidePts[insidePtCount++] = &in_tri.p[i];
+				insideLight[insideTexCount] = &in_tri.light[i];
+				insideShadow[insideTexCount] = &in_tri.shadow[i];
 				insideTex[insideTexCount++] = &in_tri.t[i];
 			}
 			else
 			{
 				outsidePts[outsidePtCount++] = &in_tri.p[i];
+				outsideLight[outsideTexCount] = &in_tri.light[i];
+				outsideShadow[outsideTexCount] = &in_tri.shadow[i];
 				outsideTex[outsideTexCount++] = &in_tri.t[i];
 			}
 		}
@@ -794,6 +1406,8 @@ private:
 			//The inside point remains in place
 			out_tri1.p[0] = *insidePts[0];
 			out_tri1.t[0] = *insideTex[0];
+			out_tri1.light[0] = *insideLight[0];
+			out_tri1.shadow[0] = *insideShadow[0];
 
 			//The outside points must be clipped to where they intersect with the plane
 			float t;
@@ -803,6 +1417,8 @@ private:
 								t * (outsideTex[0]->v - insideTex[0]->v) + insideTex[0]->v,
 								t * (outsideTex[0]->w - insideTex[0]->w) + insideTex[0]->w
 							};
+			out_tri1.light[1] = PixelLerp(*insideLight[0], *outsideLight[0], t);
+			out_tri1.shadow[1] = insideShadow[0]->lerp(*outsideShadow[0], t);
 
 			out_tri1.p[2] = IntersectPlane(plane_p, plane_n, *insidePts[0], *outsidePts[1], t);
 			out_tri1.t[2] = {
@@ -810,6 +1426,8 @@ private:
 								t * (outsideTex[1]->v - insideTex[0]->v) + insideTex[0]->v,
 								t * (outsideTex[1]->w - insideTex[0]->w) + insideTex[0]->w
 							};
+			out_tri1.light[2] = PixelLerp(*insideLight[0], *outsideLight[1], t);
+			out_tri1.shadow[2] = insideShadow[0]->lerp(*outsideShadow[1], t);
 
 			return 1; //Only returning this newly created single triangle
 		}
@@ -827,6 +1445,10 @@ private:
 			out_tri1.p[1] = *insidePts[1];
 			out_tri1.t[0] = *insideTex[0];
 			out_tri1.t[1] = *insideTex[1];
+			out_tri1.light[0] = *insideLight[0];
+			out_tri1.light[1] = *insideLight[1];
+			out_tri1.shadow[0] = *insideShadow[0];
+			out_tri1.shadow[1] = *insideShadow[1];
 
 			float t;
 			out_tri1.p[2] = IntersectPlane(plane_p, plane_n, *insidePts[0], *outsidePts[0], t);
@@ -835,12 +1457,18 @@ private:
 								t * (outsideTex[0]->v - insideTex[0]->v) + insideTex[0]->v,
 								t * (outsideTex[0]->w - insideTex[0]->w) + insideTex[0]->w
 							};
+			out_tri1.light[2] = PixelLerp(*insideLight[0], *outsideLight[0], t);
+			out_tri1.shadow[2] = insideShadow[0]->lerp(*outsideShadow[0], t);
 
 			//Second triangle
 			out_tri2.p[0] = *insidePts[1];
 			out_tri2.p[1] = out_tri1.p[2];
 			out_tri2.t[0] = *insideTex[1];
 			out_tri2.t[1] = out_tri1.t[2];
+			out_tri2.light[0] = *insideLight[1];
+			out_tri2.light[1] = out_tri1.light[2];
+			out_tri2.shadow[0] = *insideShadow[1];
+			out_tri2.shadow[1] = out_tri1.shadow[2];
 
 			out_tri2.p[2] = IntersectPlane(plane_p, plane_n, *insidePts[1], *outsidePts[0], t);
 			out_tri2.t[2] = {
@@ -848,29 +1476,118 @@ private:
 								t * (outsideTex[0]->v - insideTex[1]->v) + insideTex[1]->v,
 								t * (outsideTex[0]->w - insideTex[1]->w) + insideTex[1]->w
 							};
+			out_tri2.light[2] = PixelLerp(*insideLight[1], *outsideLight[0], t);
+			out_tri2.shadow[2] = insideShadow[1]->lerp(*outsideShadow[0], t);
 
 			return 2;
 		}
 		return 0;
 	}
 
-	//Returns false if the point does not appear on screen, true otherwise
-	bool WorldToScreenSpace(vec3d worldPt, vi2d& screenPt, mat4x4& matTrans, mat4x4& matView, mat4x4& matProj)
+	//Whether a clip space triangle faces the camera, from the sign of the determinant of its points' x, y and w
+	//That is the view space triple product scaled by the projection, so it holds for points behind the camera too, and can be done before clipping
+	bool FacesCamera(const triangle& tri)
+	{
+		const vec3d& a = tri.p[0];
+		const vec3d& b = tri.p[1];
+		const vec3d& c = tri.p[2];
+		float det = a.x * (b.y * c.w - b.w * c.y) - a.y * (b.x * c.w - b.w * c.x) + a.w * (b.x * c.y - b.y * c.x);
+		return det < 0.0f;
+	}
+
+	//Clips a clip space triangle to what is in front of the near plane, where w (view space depth) is at least zNear
+	//Everything is interpolated straight across, before the perspective divide. Returns number of triangles generated, keeping the winding
+	int ClipNear(const triangle& in_tri, triangle& out_tri1, triangle& out_tri2)
 	{
-		vec3d ptTrans, ptViewed, ptProj;
+		const float zNear = 0.1f;
+
+		float ds[3];
+		int insidePts[3], outsidePts[3];
+		int insidePtCount = 0, outsidePtCount = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			ds[i] = in_tri.p[i].w - zNear;
+			if (ds[i] >= 0)
+			{
+				insidePts[insidePtCount++] = i;
+			}
+			else
+			{
+				outsidePts[outsidePtCount++] = i;
+			}
+		}
+
+		if (insidePtCount == 0)
+		{
+			return 0;
+		}
+		if (insidePtCount == 3)
+		{
+			out_tri1 = in_tri;
+			return 1;
+		}
+
+		auto copyPt = [&](int i, triangle& out, int v)
+		{
+			out.p[v] = in_tri.p[i];
+			out.t[v] = in_tri.t[i];
+			out.light[v] = in_tri.light[i];
+			out.shadow[v] = in_tri.shadow[i];
+		};
+		//Point where the edge from inside point i to outside point o crosses the plane
+		auto intersectPt = [&](int i, int o, triangle& out, int v)
+		{
+			float t = ds[i] / (ds[i] - ds[o]);
+			const vec3d& pi = in_tri.p[i];
+			const vec3d& po = in_tri.p[o];
+			const vec2d& ti = in_tri.t[i];
+			const vec2d& to = in_tri.t[o];
+			out.p[v] = vec3d(pi.x + (po.x - pi.x) * t, pi.y + (po.y - pi.y) * t, pi.z + (po.z - pi.z) * t, pi.w + (po.w - pi.w) * t);
+			out.t[v] = vec2d(ti.u + (to.u - ti.u) * t, ti.v + (to.v - ti.v) * t, ti.w + (to.w - ti.w) * t);
+			out.light[v] = PixelLerp(in_tri.light[i], in_tri.light[o], t);
+			out.shadow[v] = in_tri.shadow[i].lerp(in_tri.shadow[o], t);
+		};
+
+		out_tri1.matIndex = in_tri.matIndex;
+		out_tri2.matIndex = in_tri.matIndex;
 
-		ptTrans = worldPt * matTrans;
+		if (insidePtCount == 1)
+		{
+			//Two points are behind the plane, so the triangle just becomes smaller
+			int a = insidePts[0], b = (a + 1) % 3, c = (a + 2) % 3;
+			copyPt(a, out_tri1, 0);
+			intersectPt(a, b, out_tri1, 1);
+			intersectPt(a, c, out_tri1, 2);
+			return 1;
+		}
+
+		//One point is behind the plane, so the triangle becomes a quad, split into two triangles
+		int c = outsidePts[0], a = (c + 1) % 3, b = (c + 2) % 3;
+		copyPt(a, out_tri1, 0);
+		copyPt(b, out_tri1, 1);
+		intersectPt(b, c, out_tri1, 2);
+
+		copyPt(a, out_tri2, 0);
+		out_tri2.p[1] = out_tri1.p[2];
+		out_tri2.t[1] = out_tri1.t[2];
+		out_tri2.light[1] = out_tri1.light[2];
+		out_tri2.shadow[1] = out_tri1.shadow[2];
+		intersectPt(a, c, out_tri2, 2);
+		return 2;
+	}
 
-		ptViewed = ptTrans * matView;
+	//Returns false if the point does not appear on screen, true otherwise
+	//matMVP takes the point all the way to clip space, e.g. a model matrix times matViewProj
+	bool WorldToScreenSpace(vec3d worldPt, vi2d& screenPt, const mat4x4& matMVP)
+	{
+		vec3d ptProj = worldPt * matMVP;
 
 		//Clip points behind camera
-		if (ptViewed.z < 0)
+		if (ptProj.w < 0)
 		{
 			return false;
 		}
 
-		ptProj = ptViewed * matProj;
-
 		//Scale into view
 		if (ptProj.w != 0.0f)
 		{
@@ -891,14 +1608,46 @@ private:
 		return true;
 	}
 
+	//Overlays drawn in software go straight into the frame from their sprites, so no decal, and no texture on the GPU, is made for them
+	void DrawOverlayPanel(PixelGameEngine* ge, const vf2d& pos, TextPanels::panel& pnl, const vf2d& scale)
+	{
+		if (softwareDecals)
+		{
+			decalCompositor.DrawSprite(ge->GetDrawTarget(), pos, pnl.sprite.get(), scale);
+		}
+		else
+		{
+			ge->DrawDecal(pos, pnl.GetDecal(), scale);
+		}
+	}
+
+	void DrawOverlayText(PixelGameEngine* ge, Font& font, const vf2d& pos, const string& s, Pixel col, const vf2d& scale)
+	{
+		if (softwareDecals)
+		{
+			for (const auto& glyph : font.GetLayoutProp(s, scale).vGlyphs)
+			{
+				decalCompositor.DrawPartialSprite(ge->GetDrawTarget(), pos + glyph.first, font.GetSprite(), glyph.second->first, glyph.second->second, scale, col);
+			}
+		}
+		else
+		{
+			font.DrawStringPropDecal(pos, s, col, scale);
+		}
+	}
+
 public:
 	void Create(PixelGameEngine* ge, string objectFile)
 	{
-		screenW = ge->ScreenWidth();
-		screenH = ge->ScreenHeight();
+		screenW = renderW = ge->ScreenWidth();
+		screenH = renderH = ge->ScreenHeight();
 
+		//Big enough for the full resolution; lower resolutions use the start of them
 		depthBuffer = new float[screenW * screenH];
 		bloomBuffer = new Pixel[screenW * screenH];
+		bloomDepth = new float[screenW * screenH];
+		renderBuffer.resize(screenW * screenH);
+		bloom = make_unique<Bloom>(renderW, renderH, workers);
 
 		mesh m("Test1");
 		m.position = vec3d();
@@ -912,7 +1661,12 @@ public:
 		azeret_mono = make_unique<Font>("./olcPGEX_Font-master/AzeretMono-Regular.png");
 		martel_light = make_unique<Font>("./olcPGEX_Font-master/Martel-Light.png");
 
+		sceneFile = objectFile;
 		LoadFromObjectFile(objectFile, meshes, materials, textures, modifiers, paths);
+		prevCamYaw = drawYaw = camYaw; //Nothing has stepped yet, so the camera is drawn where it starts
+		prevCamTilt = drawTilt = camTilt;
+		prevCamFOV = drawFOV = camFOV;
+		watcher.Watch({ objectFile + ".obj", objectFile + ".mtl", objectFile + ".pth", objectFile + ".mdfr" });
 
 		matProj = CalculateProjectionMatrix(0.1f, 1000.0f, 100.0f, screenW, screenH);
 
@@ -946,6 +1700,11 @@ public:
 		debugMode = !debugMode;
 		debugText = "Debug mode enabled.";
 	}
+	void ToggleSoftwareDecals()
+	{
+		softwareDecals = !softwareDecals;
+		debugText = softwareDecals ? "Decals drawn in software." : "Decals drawn by the renderer.";
+	}
 	void ZoomFOV(float amt)
 	{
 		camFOV += amt;
@@ -986,28 +1745,150 @@ public:
 		}
 	}
 
-	void Update(PixelGameEngine* ge, float fElapsedTime)
+	//Puts the camera and paths where a recorded frame had them, and holds them there for the simulation to go on from
+	void ApplyFrame(const cameraFrame& f)
 	{
-		timePassed += fElapsedTime;
-
-		ge->Clear(GREY);
+		timePassed = f.time;
+		camPos = vec3d(f.pos[0], f.pos[1], f.pos[2]);
+		prevCamYaw = camYaw = drawYaw = f.yaw;
+		prevCamTilt = camTilt = drawTilt = f.tilt;
+		prevCamFOV = camFOV = drawFOV = f.fov;
 
-		//Clear depth buffer
-		for (int i = 0; i < screenW * screenH; i++)
+		for (int i = 0; i < (int)min(paths.size(), f.paths.size()); i++)
 		{
-			depthBuffer[i] = 0.0f;
+			path& p = paths[i];
+			p.currInfoPt = max(0, min((int)p.infoPts.size() - 1, (int)f.paths[i].currInfoPt));
+			p.isMoving = f.paths[i].isMoving != 0 && p.currInfoPt > 0;
+			p.posT = f.paths[i].posT;
+			p.prevLength = p.drawLength = f.paths[i].drawLength;
 		}
+	}
+
+	//One fixed step of everything that moves by itself
+	void Simulate(float dt)
+	{
+		simTime += dt;
+		prevCamYaw = camYaw;
+		prevCamTilt = camTilt;
+		prevCamFOV = camFOV;
 
-		vec3d pathLookAtTarget;
 		//Update paths
+		pathLookAtTarget = vec3d();
+		for (path& p : paths)
+		{
+			p.BeginStep();
+			p.Update(dt, pathLookAtTarget, camFOV, meshes);
+		}
+
+		if (!camOverridePathLookAt && !debugMode) //Turn towards the path target for lookat
+		{
+			//From where the camera's path has got to, if it has one; otherwise from where it was last drawn
+			vec3d eye = camPos;
+			if (cameraMod != -1 && modifiers[cameraMod].pathIndex != -1 && !modifiers[cameraMod].useTransformAsPathOffset)
+			{
+				eye = paths[modifiers[cameraMod].pathIndex].getStepPosition();
+			}
+			vec3d lookDir = (pathLookAtTarget - eye).normalized();
+
+			float toCamTilt = (asin(-lookDir.y));
+			float toCamYaw = (atan2(lookDir.z, lookDir.x) - PI/2);
+
+			//Turned the short way round, without having to wrap the yaw
+			quaternion toCamRot = CameraRotation(toCamYaw, toCamTilt);
+			CameraAngles(quaternion::slerp(CameraRotation(camYaw, camTilt), toCamRot, min(1.0f, 3*dt)), camYaw, camTilt);
+		}
+	}
+
+	//Camera and paths as they were drawn this frame, to record
+	cameraFrame CaptureFrame(float fElapsedTime)
+	{
+		cameraFrame f;
+		f.dt = fElapsedTime;
+		f.time = timePassed;
+		f.pos[0] = camPos.x;
+		f.pos[1] = camPos.y;
+		f.pos[2] = camPos.z;
+		f.yaw = drawYaw;
+		f.tilt = drawTilt;
+		f.fov = drawFOV;
 		for (path& p : paths)
 		{
-			p.Update(fElapsedTime, pathLookAtTarget, camFOV, meshes);
+			f.paths.push_back({ p.currInfoPt, p.isMoving, p.posT, p.drawLength });
+		}
+		return f;
+	}
+
+	//Draws the next frame from a recorded one, in place of the simulation. The frame has to outlive the next Update()
+	void ReplayFrame(const cameraFrame* frame)
+	{
+		replayFrame = frame;
+	}
+
+	int PathCount() const
+	{
+		return (int)paths.size();
+	}
+
+	void Update(PixelGameEngine* ge, float fElapsedTime)
+	{
+		auto passStart = chrono::steady_clock::now();
+
+		//===== SIMULATION =====
+		bool replaying = replayFrame != nullptr;
+		if (hotReloadEnabled && !replaying)
+		{
+			UpdateHotReload();
+		}
+
+		if (replaying) //Drawn exactly as it was recorded
+		{
+			ApplyFrame(*replayFrame);
+			replayFrame = nullptr;
+		}
+		else
+		{
+			simAccumulator = min(simAccumulator + fElapsedTime, maxSimSteps * simStep);
+			while (simAccumulator >= simStep)
+			{
+				Simulate(simStep);
+				simAccumulator -= simStep;
+			}
+
+			//Everything below is drawn between the last two steps
+			float simAlpha = simAccumulator / simStep;
+			timePassed = max(0.0f, simTime - simStep + simAccumulator);
+			for (path& p : paths)
+			{
+				p.Interpolate(simAlpha);
+			}
+
+			drawFOV = prevCamFOV + (camFOV - prevCamFOV) * simAlpha;
+			drawYaw = camYaw;
+			drawTilt = camTilt;
+			if (!camOverridePathLookAt && !debugMode)
+			{
+				quaternion drawRot = quaternion::slerp(CameraRotation(prevCamYaw, prevCamTilt), CameraRotation(camYaw, camTilt), simAlpha);
+				CameraAngles(drawRot, drawYaw, drawTilt);
+			}
+			else //Looked around directly, so drawn as it is
+			{
+				prevCamYaw = camYaw;
+				prevCamTilt = camTilt;
+			}
+		}
+
+		//At full size, draw straight to the screen. No need to clear either; everything left empty by geometry gets the sky
+		drawTarget = renderW == screenW && renderH == screenH ? ge->GetDrawTarget()->GetData() : renderBuffer.data();
+
+		//Swap in the current frame of any streamed textures
+		for (unique_ptr<ImageSequence>& seq : sequences)
+		{
+			seq->Advance(timePassed);
 		}
 
 		//===== CAMERA TRANSFORMATIONS =====
-		matProj = CalculateProjectionMatrix(0.1f, 1000.0f, camFOV, screenW, screenH);
-		if (!debugMode)
+		matProj = CalculateProjectionMatrix(0.1f, 1000.0f, drawFOV, screenW, screenH);
+		if (!debugMode && !replaying)
 		{
 			//Camera modifiers
 			if (cameraMod != -1)
@@ -1030,174 +1911,194 @@ public:
 		vec3d upVec = { 0, 1, 0 };
 		vec3d target = { 0, 0, 1 };
 
-		if (!camOverridePathLookAt && !debugMode) //Use path target for lookat
-		{
-			camDir = (pathLookAtTarget - camPos).normalized();
+		camDir = CameraRotation(drawYaw, drawTilt).rotate(target);
+
+		target = camPos + camDir;
 
-			float toCamTilt = (asin(-camDir.y));
-			float toCamYaw = (atan2(camDir.z, camDir.x) - PI/2);
+		matCam = PointAtMatrix(camPos, target, upVec);
+		matView = QuickInverseMatrix(matCam);
+		matViewProj = matView * matProj;
 
-			//Modulus to [0, TWO_PI)
-			toCamYaw = toCamYaw - TWO_PI*floor(toCamYaw / TWO_PI);
-			camYaw = camYaw - TWO_PI*floor(camYaw / TWO_PI);
 
-			camYaw = modLerp(camYaw, toCamYaw, min(1.0f, 3*fElapsedTime), TWO_PI);
-			camTilt = lerp(camTilt, toCamTilt, min(1.0f, 3*fElapsedTime));
+	
+		fogParams.start = fogStart;
+		fogParams.invRange = 1.0f / max(fogEnd - fogStart, 0.001f);
+		fogParams.col = fogCol;
+
+		//Resolve each material's span shader once for the whole frame
+		vector<spanSetup> matSetups;
+		bloomThisFrame = false;
+		for (material& mat : materials)
+		{
+			matSetups.push_back(GetSpanSetup(mat));
+			bloomThisFrame |= mat.isEmissive();
 		}
 
-		mat4x4 camRot = CalculateRotationXMatrix(camTilt);
-		camRot *= CalculateRotationYMatrix(camYaw);
-		camDir = target * camRot;
+		if (shadowsEnabled)
+		{
+			if (shadows.NeedsStaticUpdate(sunDir))
+			{
+				DrawStaticShadows();
+			}
+			shadows.BeginDynamic();
+		}
 
-		target = camPos + camDir;
+		//===== FRAME REUSE =====
+		//Once the view has held still for a frame, the static meshes' triangles are kept, and after that only the areas
+		//where something has moved or animated are drawn again
+		bool viewUnchanged = frameReuseEnabled && cache.SameView(ViewKey());
+		bool reuseFrame = viewUnchanged && cache.valid;
+		bool recordFrame = viewUnchanged && !cache.valid;
+		screenRect dynamicRect; //Where the moving meshes are drawn this frame
 
-		matCam = PointAtMatrix(camPos, target, upVec);
-		matView = QuickInverseMatrix(matCam);
+		if (recordFrame)
+		{
+			cache.staticTris.clear();
+		}
 
+		if (!reuseFrame) //Otherwise only the areas being redrawn are cleared, further down
+		{
+			for (int i = 0; i < renderW * renderH; i++)
+			{
+				depthBuffer[i] = 0.0f;
+				bloomDepth[i] = 0.0f;
+			}
+		}
 
-	
 		//Calculate triangles for drawing
 		vector<triangle> trisToRaster;
 
 		#pragma region Draw Meshes
+		UpdateTransforms();
+
 		//Cycle through each mesh
-		for (mesh &m : meshes)
+		for (int i = 0; i < (int)meshes.size(); i++)
 		{
-			if (m.modifier != -1) //Apply modifier to mesh
+			mesh& m = meshes[i];
+			if (m.sky) //Drawn by DrawSky() instead
 			{
-				modifier& mod = modifiers[m.modifier];
-
-				vec3d dpos = m.position;
-
-				vec3d& constRot = mod.constantRotation;
-				//CONSTANT ROTATION
-				matTrans  = CalculateRotationXMatrix(m.rotation.x + timePassed*constRot.x);
-				matTrans *= CalculateRotationYMatrix(m.rotation.y + timePassed*constRot.y);
-				matTrans *= CalculateRotationZMatrix(m.rotation.z + timePassed*constRot.z);
+				continue;
+			}
 
-				//FOLLOW PATH
-				if (mod.pathIndex != -1)
-				{
-					if (mod.useTransformAsPathOffset)
-					{
-						dpos += paths[mod.pathIndex].getCurrPosition();
-					}
-					else
-					{
-						m.setPos(paths[mod.pathIndex].getCurrPosition());
-						vec3d lookPos = paths[mod.pathIndex].getCurrPosition(1.0f);
+			if (reuseFrame && !m.moves) //Already projected, in the cache
+			{
+				continue;
+			}
 
-						if (mod.applyPathRotation)
-						{
-							matTrans *= CalculateRotationYMatrix(PI);
-							matTrans *= PointAtMatrix(vec3d(), (m.position - lookPos), upVec);
-						}
-					}
-				}
+			matTrans = scene.World(i);
 
+			//Model, view and projection in one, so each vertex only needs transforming once, straight into clip space
+			mat4x4 matMVP = matTrans * matViewProj;
 
-				//BILLBOARD
-				if (mod.isBillboard)
+			//Skip meshes that are entirely past full fog density
+			if (fogEnabled && m.fogCullable)
+			{
+				float centerDepth = (m.boundsCenter * matMVP).w; //Clip space w is view space depth
+				if (centerDepth - m.boundsRadius > fogEnd)
 				{
-					matTrans *= PointAtMatrix(vec3d(), (m.position - camPos + camDir), upVec);
+					continue;
 				}
+			}
 
-				//Vertices are origin-based, centered at <0, 0, 0>, so only translate them at the end, after all the rotations
-				matTrans *= CalculateTranslationMatrix(dpos.x, dpos.y, dpos.z);
 
-			}
-			else //Apply basic mesh transformations
+			//Moving meshes cast their shadows this frame; static ones are already in the shadow map
+			bool castsDynamic = shadowsEnabled && m.moves && (m.modifier == -1 || !modifiers[m.modifier].isBillboard);
+
+			//Transform each vertex once, rather than once for every triangle it is in
+			bool sharedVerts = m.indices.size() == m.tris.size() * 3;
+			if (sharedVerts)
 			{
-				matTrans  = CalculateRotationXMatrix(m.rotation.x);
-				matTrans *= CalculateRotationYMatrix(m.rotation.y);
-				matTrans *= CalculateRotationZMatrix(m.rotation.z);
-				matTrans *= CalculateTranslationMatrix(m.position.x, m.position.y, m.position.z);
+				clipVerts.resize(m.verts.size());
+				TransformPoints(m.verts.data(), clipVerts.data(), (int)m.verts.size(), matMVP);
+				if (shadowsEnabled)
+				{
+					lightVerts.resize(m.verts.size());
+					TransformPoints(m.verts.data(), lightVerts.data(), (int)m.verts.size(), matTrans);
+					for (vec3d& v : lightVerts)
+					{
+						v = shadows.ToLightSpace(v);
+					}
+				}
 			}
 
-
-			for (const triangle &tri : m.tris)
+			for (int t = 0; t < (int)m.tris.size(); t++)
 			{
-				// World Transform > View Space > Projection Space
-				triangle triTrans, triViewed, triProj;
+				const triangle& tri = m.tris[t];
+
+				// Model Space > Clip Space > Screen Space
+				triangle triClip, triProj;
 
 				//===== TRANSFORM =====
-				//Apply transformation matrix to triangle
+				if (sharedVerts)
+				{
+					for (int v = 0; v < 3; v++)
+					{
+						triClip.p[v] = clipVerts[m.indices[t * 3 + v]];
+					}
+				}
+				else
+				{
+					TransformPoints(tri.p, triClip.p, 3, matMVP);
+				}
 				for (int v = 0; v < 3; v++)
 				{
-					triTrans.p[v] = tri.p[v] * matTrans;
-					triTrans.t[v] = tri.t[v];
+					triClip.t[v] = tri.t[v];
+					triClip.light[v] = tri.light[v];
 				}
-				triTrans.matIndex = tri.matIndex;
-
-				//Establish vectors for 2 sides of the triangle
-				vec3d normal, line1, line2;
-				line1 = triTrans.p[1] - triTrans.p[0];
-				line2 = triTrans.p[2] - triTrans.p[0];
-
-				//Compute surface normal
-				normal = line1.cross(line2);
-				normal = normal.normalized();
-
-				vec3d diff = triTrans.p[0] - camPos;
-				float dot = normal.dot(diff);
+				triClip.matIndex = tri.matIndex;
 
-				//Triangle is facing camera (normal pointing towards where camera is)
-				if (dot < 0.0f)
+				//===== SHADOWS =====
+				//Done before backface culling, since faces turned away from the camera still cast
+				if (shadowsEnabled)
 				{
-					//===== CALCULATE LIGHTING ===== //TODO: Move to DrawTriangle function
-					vec3d dirLight = camDir * -1;// { 0, 1, -1 };
-						dirLight = dirLight.normalized();
-
-					//Calculate dot product between light and surface normal; This gives the light intensity on the surface
-					float lightDot = normal.dot(dirLight);
-					//materials.at(0).col = WHITE * fmax(0.1f, lightDot); //ERROR: Calculate this when drawing triangle
-					//triTrans.mat.col = WHITE * fmax(0.1f, lightDot);
-
-
-					//===== WORLD SPACE -> VIEW SPACE =====
-						//View is calculated based on camera position
-					for (int v = 0; v < 3; v++)
+					if (sharedVerts)
+					{
+						for (int v = 0; v < 3; v++)
+						{
+							triClip.shadow[v] = lightVerts[m.indices[t * 3 + v]];
+						}
+					}
+					else
+					{
+						vec3d triWorld[3];
+						TransformPoints(tri.p, triWorld, 3, matTrans);
+						for (int v = 0; v < 3; v++)
+						{
+							triClip.shadow[v] = shadows.ToLightSpace(triWorld[v]);
+						}
+					}
+					if (castsDynamic && materials[tri.matIndex].lit)
 					{
-						triViewed.p[v] = triTrans.p[v] * matView;
-						triViewed.t[v] = triTrans.t[v];
+						shadows.DrawDynamic(triClip.shadow[0], triClip.shadow[1], triClip.shadow[2]);
 					}
-					triViewed.matIndex = triTrans.matIndex;
+				}
 
+				//Triangle is facing camera
+				if (FacesCamera(triClip))
+				{
 					//===== DISTANCE CLIPPING =====
 
-					//Clip viewed triangle against near plane
+					//Clip against the near plane, in clip space
 					triangle clipped[2];
-
-					//Populate clipped[]
-						//Coords are in View Space; so are relative to camera position and direction
-					int numClippedTris = ClipAgainstPlane({ 0.0f, 0.0f, 0.1f }, { 0.0f, 0.0f, 1.0f }, triViewed, clipped[0], clipped[1]);
+					int numClippedTris = ClipNear(triClip, clipped[0], clipped[1]);
 
 					//The clip may produce up to 2 resultant triangles
 					for (int n = 0; n < numClippedTris; n++)
 					{
-						//===== VIEW SPACE -> PROJECTION SPACE =====
-							//Converts clipped 3D triangles to 2D projection
-						for (int v = 0; v < 3; v++)
-						{
-							triProj.p[v] = clipped[n].p[v] * matProj;
-							triProj.t[v] = clipped[n].t[v];
-						}
-						triProj.matIndex = clipped[n].matIndex;
+						triProj = clipped[n];
 
 						//UV Perspective Correction
 						for (int v = 0; v < 3; v++)
 						{
 							triProj.t[v] /= triProj.p[v].w;
 							triProj.t[v].w = 1.0f / triProj.p[v].w;
+							triProj.shadow[v] = triProj.shadow[v] * triProj.t[v].w; //Corrected the same way
 						}
 
-						//Scale into view
+						//Perspective divide. Everything left is in front of the near plane, so w is never 0
 						for (int v = 0; v < 3; v++)
 						{
-							if (triProj.p[v].w != 0.0f)
-							{
-								triProj.p[v] /= triProj.p[v].w;
-							}
+							triProj.p[v] /= triProj.p[v].w;
 						}
 
 						//x/y are inverted, so put them back
@@ -1218,104 +2119,166 @@ public:
 
 						for (int i = 0; i < 3; i++)
 						{
-							triProj.p[i].x *= 0.5f * screenW;
-							triProj.p[i].y *= 0.5f * screenH;
+							triProj.p[i].x *= 0.5f * renderW;
+							triProj.p[i].y *= 0.5f * renderH;
 						}
 
 						//Load screen space coords into list for rasterization
 						trisToRaster.push_back(triProj);
+
+						if (m.moves)
+						{
+							for (int v = 0; v < 3; v++)
+							{
+								dynamicRect.add(triProj.p[v].x, triProj.p[v].y);
+							}
+						}
+						else if (recordFrame)
+						{
+							cache.staticTris.push_back(triProj);
+						}
 					}
 				}
 			}
 		}
 		#pragma endregion
 
-		for (triangle& triToRaster : trisToRaster)
+		//Work out what needs drawing again: wherever the moving meshes are now or were last frame,
+		//static triangles with materials that have animated, and wherever moving meshes' shadows may have changed
+		screenRect redraw(0, 0, renderW - 1, renderH - 1);
+		if (reuseFrame)
 		{
-			#pragma region SCREEN CLIPPING
-			//Clip triangles against all four screen edges
-			triangle clipped[2];
-			list<triangle> tris;
-			tris.push_back(triToRaster);
-			int newTris = 1;
+			redraw = dynamicRect;
+			redraw.add(cache.prevDynamic);
 
-			for (int p = 0; p < 4; p++)
+			for (int i = 0; i < (int)materials.size(); i++)
 			{
-				int trisToAdd = 0;
-				while (newTris > 0)
+				const spanSetup& a = matSetups[i];
+				const spanSetup& b = prevMatSetups[i];
+				if (materials[i].sequenceIndex != -1 || a.tex != b.tex || a.frameOffsetU != b.frameOffsetU || a.frameOffsetV != b.frameOffsetV)
 				{
-					triangle test = tris.front();
-					tris.pop_front();
-					newTris--;
-
-					//Clip in Screen Space along each of the screen border planes
-					switch (p)
-					{
-					case 0:
-						trisToAdd = ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, test, clipped[0], clipped[1]);
-						break;
-					case 1:
-						trisToAdd = ClipAgainstPlane({ 0.0f, (float)screenH-1, 0.0f }, { 0.0f, -1.0f, 0.0f }, test, clipped[0], clipped[1]);
-						break;
-					case 2:
-						trisToAdd = ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]);
-						break;
-					case 3:
-						trisToAdd = ClipAgainstPlane({ (float)screenW-1, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]);
-						break;
-					}
-
-					//Clipping may yield many triangles, which must be added to the back of the queue
-					//to be tested for clipping against the other sides of the screen border
-					for (int t = 0; t < trisToAdd; t++)
-					{
-						tris.push_back(clipped[t]);
-					}
+					redraw.add(cache.materialRects[i]);
 				}
-				newTris = tris.size();
 			}
-			#pragma endregion
 
-			#pragma region RASTERIZE TRIANGLES
-			for (triangle& t : tris)
+			vec3d corners[8];
+			if (shadowsEnabled && shadows.DynamicChangeBox(corners))
 			{
+				redraw.add(ProjectedBounds(corners, 8));
+			}
+
+			//A pixel of margin, since the rasterizer rounds vertices to whole pixels
+			redraw = redraw.padded(1, renderW, renderH);
 
-				if (materials[t.matIndex].textureIndex == -1) //Use solid material color
+			trisToRaster.insert(trisToRaster.end(), cache.staticTris.begin(), cache.staticTris.end());
+
+			//Start from the last frame, and clear just the areas being redrawn
+			if (!redraw.empty())
+			{
+				copy(cache.preBloom.begin(), cache.preBloom.end(), drawTarget);
+			}
+			for (int i = redraw.y0; i <= redraw.y1; i++)
+			{
+				fill(depthBuffer + i * renderW + redraw.x0, depthBuffer + i * renderW + redraw.x1 + 1, 0.0f);
+				fill(bloomDepth + i * renderW + redraw.x0, bloomDepth + i * renderW + redraw.x1 + 1, 0.0f);
+			}
+		}
+		cache.prevDynamic = dynamicRect;
+		prevMatSetups = matSetups;
+
+		#pragma region RENDER QUEUES
+		//Opaque triangles are drawn front to back, so as much as possible of what they cover fails the depth test early
+		//Blended triangles are drawn afterwards, back to front, so each one blends over everything behind it
+		vector<pair<float, int>> opaqueQueue, blendedQueue; //<sum of vertex depths (larger is closer), index into trisToRaster>
+		for (int t = 0; t < (int)trisToRaster.size(); t++)
+		{
+			const triangle& tri = trisToRaster[t];
+			if (reuseFrame)
+			{
+				screenRect bounds;
+				for (int v = 0; v < 3; v++)
 				{
-					ColouredTriangle(t.p[0].x, t.p[0].y, t.t[0].u, t.t[0].v, t.t[0].w,
-									 t.p[1].x, t.p[1].y, t.t[1].u, t.t[1].v, t.t[1].w,
-									 t.p[2].x, t.p[2].y, t.t[2].u, t.t[2].v, t.t[2].w,
-									 materials[t.matIndex].col, ge);
-				//	TexturedTriangle(t.p[0].x, t.p[0].y, t.t[0].u, t.t[0].v, t.t[0].w,
-				//					 t.p[1].x, t.p[1].y, t.t[1].u, t.t[1].v, t.t[1].w,
-				//					 t.p[2].x, t.p[2].y, t.t[2].u, t.t[2].v, t.t[2].w,
-				//					 0, ge);
+					bounds.add(tri.p[v].x, tri.p[v].y);
 				}
-				else										  //Use material texture
+				if (!bounds.overlaps(redraw))
 				{
-						TexturedTriangle(t.p[0].x, t.p[0].y, t.t[0].u, t.t[0].v, t.t[0].w,
-										 t.p[1].x, t.p[1].y, t.t[1].u, t.t[1].v, t.t[1].w,
-										 t.p[2].x, t.p[2].y, t.t[2].u, t.t[2].v, t.t[2].w,
-										 t, ge);
+					continue;
 				}
+			}
 
+			float depth = tri.t[0].w + tri.t[1].w + tri.t[2].w;
+			(matSetups[tri.matIndex].blended ? blendedQueue : opaqueQueue).push_back({ depth, t });
+		}
+		sort(opaqueQueue.begin(), opaqueQueue.end(), [](const pair<float, int>& a, const pair<float, int>& b) { return a.first > b.first; });
+		sort(blendedQueue.begin(), blendedQueue.end(), [](const pair<float, int>& a, const pair<float, int>& b) { return a.first < b.first; });
+		#pragma endregion
 
-				//Center points
-				vec2d center(t.p[0].x + t.p[1].x + t.p[2].x, t.p[0].y + t.p[1].y + t.p[2].y);
-				center /= 3;
-				//ge->DrawString(center.x, center.y, to_string(t.matIndex), BLACK);
-				//ge->DrawString(center.x, center.y, to_string(depthBuffer[(int)center.x*screenW + (int)center.y]), WHITE);
-				//Wireframe
-				//ge->DrawTriangle(t.p[0].x, t.p[0].y, t.p[1].x, t.p[1].y, t.p[2].x, t.p[2].y, GREEN);
+		if (!redraw.empty())
+		{
+			scissor = redraw;
+			for (pair<float, int>& q : opaqueQueue)
+			{
+				ClipAndRasterTriangle(trisToRaster[q.second], matSetups);
+			}
+
+			//After the opaque triangles, so only what they left empty is filled, but before the blended ones, so they blend over it
+			DrawSky(redraw);
+
+			for (pair<float, int>& q : blendedQueue)
+			{
+				ClipAndRasterTriangle(trisToRaster[q.second], matSetups);
+			}
+
+			if (recordFrame || reuseFrame)
+			{
+				cache.preBloom.assign(drawTarget, drawTarget + renderW * renderH);
+			}
+
+			//Glow around emissive surfaces, before any text goes on top
+			if (bloomThisFrame)
+			{
+				bloom->Apply(drawTarget, bloomBuffer, bloomDepth, depthBuffer, bloomStrength);
+			}
+
+			if (recordFrame || reuseFrame)
+			{
+				cache.postBloom.assign(drawTarget, drawTarget + renderW * renderH);
+			}
+		}
+		else //Nothing has changed at all
+		{
+			copy(cache.postBloom.begin(), cache.postBloom.end(), drawTarget);
+		}
+
+		if (recordFrame)
+		{
+			cache.materialRects.assign(materials.size(), screenRect());
+			for (triangle& t : cache.staticTris)
+			{
+				for (int v = 0; v < 3; v++)
+				{
+					cache.materialRects[t.matIndex].add(t.p[v].x, t.p[v].y);
+				}
 			}
+			cache.valid = true;
+		}
 
-			//TODO: Particles
-			//for(particle& p : particles) ...
-			#pragma endregion
+		if (drawTarget == renderBuffer.data())
+		{
+			UpscaleBilinear(drawTarget, renderW, renderH, ge->GetDrawTarget()->GetData(), screenW, screenH, workers);
+		}
+
+		//Size of the next frame's 3D pass, from how long this one took
+		if (dynamicResolutionEnabled)
+		{
+			float passMs = chrono::duration<float, milli>(chrono::steady_clock::now() - passStart).count();
+			if (resolution.Update(passMs))
+			{
+				SetRenderSize(max(1, (int)(screenW * resolution.Scale())), max(1, (int)(screenH * resolution.Scale())));
+			}
 		}
 
 		//Draw Info Points Text
-		matTrans = IdentityMatrix();
 		for (path& p : paths)
 		{
 			if (p.canMoveForward(-1) || p.currInfoPt == 0)
@@ -1325,29 +2288,18 @@ public:
 				vi2d screenPos;
 				for (text& tx : ip.texts)
 				{
-					if (WorldToScreenSpace(tx.pos, screenPos, matTrans, matView, matProj))
+					if (WorldToScreenSpace(tx.pos, screenPos, matViewProj))
 					{
 						float allScale = max(0.0f, 1.0f-(screenPos - vi2d(screenW/2, screenH/2)).mag2()/(float)vi2d(screenW/2, screenH/2).mag2());
 						allScale *= allScale * 0.9f;
 
-						vi2d titleSize = lato_bold->GetTextSizeProp(tx.title);
-						titleSize = vi2d(titleSize.x * allScale, titleSize.y * allScale);
-
-						vi2d descSize = azeret_mono->GetTextSizeProp(tx.description);
-						descSize = vi2d(descSize.x * 0.25f * allScale, descSize.y * 0.25f * allScale);
+						TextPanels::panel& pnl = textPanels.Get(*lato_bold, *azeret_mono, tx, allScale);
+						float fit = allScale / pnl.scale;
 
-						vi2d boxSize = vi2d(max(titleSize.x, descSize.x) + tx.borderSize.x, titleSize.y + descSize.y + tx.borderSize.y);
+						vf2d boxSize = vf2d(pnl.sprite->width * fit, pnl.sprite->height * fit);
 						vi2d screenPosShift = screenPos - boxSize / 2; //Center text around point
 
-						ge->SetPixelMode(Pixel::ALPHA);
-						ge->FillRect(screenPosShift.x, screenPosShift.y, boxSize.x, boxSize.y, Pixel(255, 255, 255, 230));
-						ge->SetPixelMode(Pixel::NORMAL);
-
-						//Title
-						lato_bold->DrawStringPropDecal(screenPosShift + tx.borderSize/2, tx.title, BLACK, vf2d(allScale, allScale));
-
-						//Description
-						azeret_mono->DrawStringPropDecal(screenPosShift + vi2d(2, 0 + titleSize.y) + tx.borderSize/2, tx.description, BLACK, vf2d(0.25f * allScale, 0.25f * allScale));
+						DrawOverlayPanel(ge, screenPosShift, pnl, vf2d(fit, fit));
 
 						if (debugMode)
 						{
@@ -1360,6 +2312,8 @@ public:
 			}
 		}
 
+		textPanels.EndFrame();
+
 		//Info point continue text
 		bool canMove = true;
 		for (path& p : paths)
@@ -1370,7 +2324,7 @@ public:
 		{
 			vf2d txSize = azeret_mono->GetTextSizeProp("Press [Space] to continue, [RMB] to look around.");
 			txSize *= 0.3f;
-			azeret_mono->DrawStringPropDecal(vi2d(screenW/2 - txSize.x/2, screenH - 20 - txSize.y/2), "Press [Space] to continue, [RMB] to look around.", WHITE, {0.3f, 0.3f});
+			DrawOverlayText(ge, *azeret_mono, vi2d(screenW/2 - txSize.x/2, screenH - 20 - txSize.y/2), "Press [Space] to continue, [RMB] to look around.", WHITE, {0.3f, 0.3f});
 		}
 
 		//Debug overlay
@@ -1381,50 +2335,68 @@ public:
 			for (path& p : paths)
 			{
 				Pixel debugCol = Pixel(j*127, 0, 255-j*127);
+				//Everything on the path is relative to its position
+				mat4x4 pathMVP = CalculateTranslationMatrix(p.position.x, p.position.y, p.position.z) * matViewProj;
+
 				//Path points
 				int i = 0;
 				for (vec3d& pt : p.pts)
 				{
-					matTrans = CalculateTranslationMatrix(p.position.x, p.position.y, p.position.z);
-
 					vi2d ptToRaster;
-					if (WorldToScreenSpace(pt, ptToRaster, matTrans, matView, matProj))
+					if (WorldToScreenSpace(pt, ptToRaster, pathMVP))
 					{
-						matTrans *= CalculateTranslationMatrix(pt.x, pt.y, pt.z);
-						matTrans *= CalculateTranslationMatrix(p.position.x, p.position.y, p.position.z);
-
 						ge->DrawRect(ptToRaster, { 2, 2 }, debugCol);
 						ge->DrawString(ptToRaster + vi2d(3, 3), to_string(i), RED, 1);
 					}
 					i++;
 				}
 
-				matTrans = CalculateTranslationMatrix(p.position.x, p.position.y, p.position.z);
+				//The curve through them, evenly spaced along it
+				vector<float> fractions(max(0, (int)p.pts.size() - 1) * 8 + 1);
+				for (int k = 0; k < (int)fractions.size(); k++)
+				{
+					fractions[k] = fractions.size() > 1 ? k / (float)(fractions.size() - 1) : 0.0f;
+				}
+				vector<vec3d> curve;
+				p.getPointsAlong(fractions, curve);
+
+				vi2d prevToRaster;
+				bool prevVisible = false;
+				for (vec3d& pt : curve)
+				{
+					vi2d ptToRaster;
+					bool visible = WorldToScreenSpace(pt, ptToRaster, pathMVP);
+					if (visible && prevVisible)
+					{
+						ge->DrawLine(prevToRaster, ptToRaster, debugCol);
+					}
+					prevToRaster = ptToRaster;
+					prevVisible = visible;
+				}
+
 				//Info points
 				for (infoPoint& ip : p.infoPts)
 				{
 					vi2d ptToRaster;
-					if (WorldToScreenSpace(p.pts[ip.pathPtIndex], ptToRaster, matTrans, matView, matProj))
+					if (WorldToScreenSpace(p.pts[ip.pathPtIndex], ptToRaster, pathMVP))
 					{
 						ge->DrawRect(ptToRaster, { 2, 2 }, GREEN);
 						ge->DrawString(ptToRaster + vi2d(10, 10), to_string(ip.fov), GREEN, 1);
 					}
 				}
 
-				matTrans = CalculateTranslationMatrix(p.position.x, p.position.y, p.position.z);
-
 				//Current pos & Ahead pos on path
 				vi2d currPosToRaster, aheadPosToRaster;
 				vec3d currPos = p.getCurrPosition();
 				vec3d aheadPos = p.getCurrPosition(1.0f);
 				//Ahead pos
-				if (WorldToScreenSpace(aheadPos, aheadPosToRaster, matTrans, matView, matProj))
+				if (WorldToScreenSpace(aheadPos, aheadPosToRaster, pathMVP))
 				{
 					ge->DrawLine(aheadPosToRaster + vi2d(3, -3), aheadPosToRaster + vi2d(-3, 3), CYAN);
 					ge->DrawLine(aheadPosToRaster + vi2d(-3, -3), aheadPosToRaster + vi2d(3, 3), CYAN);
 				}
 				//Curr pos
-				if (WorldToScreenSpace(currPos, currPosToRaster, matTrans, matView, matProj))
+				if (WorldToScreenSpace(currPos, currPosToRaster, pathMVP))
 				{
 					ge->DrawLine(currPosToRaster + vi2d(3, -3), currPosToRaster + vi2d(-3, 3), MAGENTA);
 					ge->DrawLine(currPosToRaster + vi2d(-3, -3), currPosToRaster + vi2d(3, 3), MAGENTA);
@@ -1434,20 +2406,20 @@ public:
 				j++;
 			}
 
-			matTrans = IdentityMatrix();
 			matCam = PointAtMatrix(camPos, target, upVec);
 			matView = QuickInverseMatrix(matCam);
+			matViewProj = matView * matProj;
 
 			//Axis indicator
 			vec3d  axes[] = { vec3d(100, 0, 0), vec3d(0, 100, 0), vec3d(0, 0, 100) };
 			Pixel  cols[] = { RED,			  GREEN,		  BLUE			 };
 			string syms[] = { "X",			  "Y",			  "Z"			 };
 			vi2d originToRaster;
-			WorldToScreenSpace(vec3d(), originToRaster, matTrans, matView, matProj);
+			WorldToScreenSpace(vec3d(), originToRaster, matViewProj);
 			for (int a = 0; a < 3; a++)
 			{
 				vi2d axisToRaster;
-				WorldToScreenSpace(axes[a], axisToRaster, matTrans, matView, matProj);
+				WorldToScreenSpace(axes[a], axisToRaster, matViewProj);
 				ge->DrawLine(originToRaster, axisToRaster, cols[a]);
 				ge->DrawString(axisToRaster, syms[a], cols[a]);
 			}
@@ -1457,7 +2429,7 @@ public:
 			{
 				for (int j = 0; j < screenW/4; j++)
 				{
-					ge->Draw(3*screenW/4 + j, 3*screenH/4 + i, WHITE*(1.0f/(debugDepthValue*depthBuffer[(4*i*screenW) + 4*j])));
+					ge->Draw(3*screenW/4 + j, 3*screenH/4 + i, WHITE*(1.0f/(debugDepthValue*depthBuffer[(4*i*renderH/screenH)*renderW + 4*j*renderW/screenW])));
 				}
 			}
 
@@ -1468,328 +2440,401 @@ public:
 				debugOutput += to_string(p.currInfoPt) + ", ";
 			}
 			debugOutput += "]\n";
+			if (softwareDecals)
+			{
+				debugOutput += " Decals: " + to_string(decalCompositor.lastMs) + "ms\n";
+			}
 
-			arial->DrawStringPropDecal({ 5, 5 }, debugOutput, GREEN, {0.2, 0.2});
+			DrawOverlayText(ge, *arial, { 5, 5 }, debugOutput, GREEN, {0.2f, 0.2f});
 		}
-	}
-
-	inline void DrawTexturePixel(PixelGameEngine* ge, float uTex, float vTex, float wTex, int i, int j, texture& tex, triangle& tri)
-	{
-		//TOP
-		float mipScale = materials[tri.matIndex].mipScale;
-		//int m = floor(max(0.0f, min(tex.numMips - 1.0f, 0.5f*(mipLogA - log2(tex.numMips * wTex)))));
-		//m = tex.numMips - 1;
-		int m = max(0, min(tex.numMips - 1, tex.numMips - (int)(1000 * wTex))); //Needs adjustment
-		Pixel p;
-
-		float tx = (uTex / wTex);
-		float ty = (1.0f - vTex / wTex);
 
-		tx -= floor(tx);
-		ty -= floor(ty);
-
-		if (materials[tri.matIndex].startIndex < materials[tri.matIndex].endIndex) //Use animated texture
-		{
-			int numFrames = materials[tri.matIndex].endIndex - materials[tri.matIndex].startIndex + 1;
-			int frameIndex = (int)floor(timePassed * materials[tri.matIndex].animSpeed) % (numFrames);
-
-			float frameW = 1.0f / materials[tri.matIndex].xDivisions;
-			float frameH = 1.0f / materials[tri.matIndex].yDivisions;
-
-			tx = tx / materials[tri.matIndex].xDivisions + frameW * (frameIndex % materials[tri.matIndex].xDivisions);
-			ty = ty / materials[tri.matIndex].yDivisions + frameH * (frameIndex / materials[tri.matIndex].yDivisions);
-
-			p = tex.mips[m]->Sample(tx, ty);
-			ge->Draw(j, i, p);
-		}
-		else //Use normal texture
+		//Anything else drawn as a decal this frame, into the frame itself
+		if (softwareDecals)
 		{
-			p = tex.mips[m]->Sample(tx, ty);
-			//p = m % 2 == 0 ? olc::BLACK : olc::WHITE; //View mips as stripes
-			ge->Draw(j, i, p);
+			decalCompositor.Composite(ge->GetLayers()[0]);
 		}
-
-		//Write depth
-		if(round(p.a/255.0f))
-		depthBuffer[i * screenW + j] = wTex;
 	}
 
-	void TexturedTriangle(int x1, int y1, float u1, float v1, float w1,
-						  int x2, int y2, float u2, float v2, float w2,
-						  int x3, int y3, float u3, float v3, float w3,
-						  triangle& tri, PixelGameEngine* ge)
+	enum spanFeature
 	{
-		bool useAlpha = (materials[tri.matIndex].alphaIndex != -1);
-		ge->SetPixelMode(useAlpha ? Pixel::ALPHA : Pixel::NORMAL);
-
-		texture& tex = textures[materials[tri.matIndex].textureIndex];
-
+		SPAN_TEXTURED    = 1 << 0,
+		SPAN_ALPHA_BLEND = 1 << 1,
+		SPAN_ALPHA_TEST  = 1 << 2, //Texels below half alpha don't write depth
+		SPAN_ANIMATED    = 1 << 3, //Sprite sheet animation
+		SPAN_BILINEAR    = 1 << 4,
+		SPAN_EMISSIVE    = 1 << 5, //Leaves the emissive colour in the bloom buffer
+		SPAN_FOG         = 1 << 6,
+		SPAN_CUTOUT      = 1 << 7, //Texels below half alpha are discarded entirely, the rest are drawn solid
+		SPAN_LIT         = 1 << 8, //Baked vertex lighting, interpolated across the span
+		SPAN_SHADOWED    = 1 << 9, //Sunlight is taken back out of the lighting wherever the shadow map blocks it
+		SPAN_FEATURE_COMBINATIONS = 1 << 10
+	};
+
+	//Everything interpolated across a triangle, at one point along an edge
+	struct spanVertex
+	{
+		float u, v, w; //Perspective-divided UVs, and w = 1/z
+		float r, g, b; //Baked lighting, 0-255
+		float sx, sy, sz; //Perspective-divided shadow map position
+
+		spanVertex operator+(const spanVertex& a) const { return { u + a.u, v + a.v, w + a.w, r + a.r, g + a.g, b + a.b, sx + a.sx, sy + a.sy, sz + a.sz }; }
+		spanVertex operator-(const spanVertex& a) const { return { u - a.u, v - a.v, w - a.w, r - a.r, g - a.g, b - a.b, sx - a.sx, sy - a.sy, sz - a.sz }; }
+		spanVertex operator*(float f) const { return { u * f, v * f, w * f, r * f, g * f, b * f, sx * f, sy * f, sz * f }; }
+		spanVertex operator/(float f) const { return { u / f, v / f, w / f, r / f, g / f, b / f, sx / f, sy / f, sz / f }; }
+	};
+
+	//Features that make no difference to a span are dropped, so combinations that shade the same share one shader
+	static constexpr int CanonicalSpanFeatures(int features)
+	{
+		if (!(features & SPAN_LIT)) //No sunlight to take back out
+		{
+			features &= ~SPAN_SHADOWED;
+		}
+		return !(features & SPAN_TEXTURED) ? features & (SPAN_EMISSIVE | SPAN_FOG | SPAN_LIT | SPAN_SHADOWED)
+			 : (features & SPAN_CUTOUT)    ? features & ~(SPAN_ALPHA_BLEND | SPAN_ALPHA_TEST)
+			 : features;
+	}
 
+	struct spanSetup;
+	typedef void (Engine3D::*spanShader)(const spanSetup& setup, int i, int ax, int bx, const spanVertex& sv, const spanVertex& ev);
 
-		//Sort arguments by y-position
-		if (y2 < y1)
+	//Everything the span shaders need from a material, worked out once per frame rather than per pixel
+	struct spanSetup
+	{
+		spanShader shade = nullptr;
+		Pixel col = WHITE;
+		Pixel emis = BLACK;
+		texture* tex = nullptr;
+		bool blended = false; //Drawn after everything opaque, back to front
+
+		//Sprite sheet frame, as a scale and offset applied to texture coordinates
+		float frameScaleU = 1.0f, frameScaleV = 1.0f;
+		float frameOffsetU = 0.0f, frameOffsetV = 0.0f;
+	};
+
+	//Last frame's 3D pass, for redrawing only what has changed while the view holds still
+	bool frameReuseEnabled = true;
+	frameCache cache;
+	vector<spanSetup> prevMatSetups; //To tell which materials have animated since
+
+	//Shades one horizontal span of a triangle, from ax (inclusive) to bx (exclusive) on row i
+	//Each combination of features is compiled separately, so none of them are tested inside the pixel loop
+	template<int Features>
+	void ShadeSpan(const spanSetup& setup, int i, int ax, int bx, const spanVertex& sv, const spanVertex& ev)
+	{
+		const bool textured   = (Features & SPAN_TEXTURED) != 0;
+		const bool alphaBlend = (Features & SPAN_ALPHA_BLEND) != 0;
+		const bool alphaTest  = (Features & SPAN_ALPHA_TEST) != 0;
+		const bool animated   = (Features & SPAN_ANIMATED) != 0;
+		const bool bilinear   = (Features & SPAN_BILINEAR) != 0;
+		const bool emissive   = (Features & SPAN_EMISSIVE) != 0;
+
+		const bool fogged     = (Features & SPAN_FOG) != 0;
+		const bool cutout     = (Features & SPAN_CUTOUT) != 0;
+		const bool lit        = (Features & SPAN_LIT) != 0;
+		const bool shadowed   = (Features & SPAN_SHADOWED) != 0;
+
+		const int rowStart = i * renderW + ax;
+		float* depthRow = depthBuffer + i * renderW;
+
+		span::output out;
+		out.col = drawTarget + rowStart;
+		out.depth = depthBuffer + rowStart;
+		if (emissive)
 		{
-			swap(y1, y2);
-			swap(x1, x2);
-			swap(u1, u2);
-			swap(v1, v2);
-			swap(w1, w2);
+			out.bloom = bloomBuffer + rowStart;
+			out.bloomDepth = bloomDepth + rowStart;
+			out.emis = setup.emis;
 		}
-		if (y3 < y1)
+		out.fogParams = &fogParams;
+
+		//Only the part inside the scissor area is written, but everything is interpolated from the whole span,
+		//so redrawing part of a frame gives exactly the same pixels as drawing all of it
+		const int sx0 = max(ax, scissor.x0), sx1 = min(bx, scissor.x1 + 1);
+		if (sx0 >= sx1)
 		{
-			swap(y1, y3);
-			swap(x1, x3);
-			swap(u1, u3);
-			swap(v1, v3);
-			swap(w1, w3);
+			return;
 		}
-		if (y3 < y2)
+
+		if (!textured && !lit) //Use solid material color
 		{
-			swap(y2, y3);
-			swap(x2, x3);
-			swap(u2, u3);
-			swap(v2, v3);
-			swap(w2, w3);
+			float wStep = (ev.w - sv.w) / (float)(bx - ax);
+			span::FillOpaque<emissive, fogged>(out, setup.col, sv.w, wStep, sx0 - ax, sx1 - ax);
+			return;
 		}
 
-		#pragma region DRAW TOP OF TRIANGLE
-
-		int dy1 = y2 - y1;
-		int dx1 = x2 - x1;
-		float dv1 = v2 - v1;
-		float du1 = u2 - u1;
-		float dw1 = w2 - w1;
-
-		int dy2 = y3 - y1;
-		int dx2 = x3 - x1;
-		float dv2 = v3 - v1;
-		float du2 = u3 - u1;
-		float dw2 = w3 - w1;
+		float tStep = 1.0f / ((float)(bx - ax));
 
-		float uTex, vTex, wTex;
+		//Work through the span in chunks, so the sampler can filter several pixels at once
+		const int chunkSize = 8;
+		float txs[chunkSize], tys[chunkSize], wTexs[chunkSize];
+		float lights[3][chunkSize];
+		float shadowPos[3][chunkSize];
+		int mips[chunkSize];
+		Pixel cols[chunkSize];
 
-		float daxStep = 0, dbxStep = 0,
-			  du1Step = 0, dv1Step = 0,
-			  du2Step = 0, dv2Step = 0,
-			  dw1Step = 0, dw2Step = 0;
+		for (int j0 = ax + (sx0 - ax) / chunkSize * chunkSize; j0 < sx1; j0 += chunkSize)
+		{
+			int n = min(chunkSize, bx - j0);
+			int firstMip = -1;
+			bool sameMip = true;
 
-		if (dy1) { daxStep = dx1 / (float)abs(dy1); }
-		if (dy2) { dbxStep = dx2 / (float)abs(dy2); }
+			for (int k = 0; k < n; k++)
+			{
+				float tLerp = (j0 - ax + k) * tStep;
+				float uTex = (1.0f - tLerp) * sv.u + tLerp * ev.u;
+				float vTex = (1.0f - tLerp) * sv.v + tLerp * ev.v;
+				wTexs[k] = (1.0f - tLerp) * sv.w + tLerp * ev.w;
+				if (lit)
+				{
+					lights[0][k] = (1.0f - tLerp) * sv.r + tLerp * ev.r;
+					lights[1][k] = (1.0f - tLerp) * sv.g + tLerp * ev.g;
+					lights[2][k] = (1.0f - tLerp) * sv.b + tLerp * ev.b;
+				}
+				if (shadowed)
+				{
+					shadowPos[0][k] = (1.0f - tLerp) * sv.sx + tLerp * ev.sx;
+					shadowPos[1][k] = (1.0f - tLerp) * sv.sy + tLerp * ev.sy;
+					shadowPos[2][k] = (1.0f - tLerp) * sv.sz + tLerp * ev.sz;
+				}
 
-		if (dy1) { du1Step = du1 / (float)abs(dy1); }
-		if (dy1) { dv1Step = dv1 / (float)abs(dy1); }
-		if (dy1) { dw1Step = dw1 / (float)abs(dy1); }
+				if (!textured) //Nothing else to work out for a solid colour
+				{
+					continue;
+				}
 
-		if (dy2) { du2Step = du2 / (float)abs(dy2); }
-		if (dy2) { dv2Step = dv2 / (float)abs(dy2); }
-		if (dy2) { dw2Step = dw2 / (float)abs(dy2); }
+				if (wTexs[k] <= depthRow[j0 + k]) //Hidden, don't bother working out its texture coordinates
+				{
+					txs[k] = tys[k] = 0.0f;
+					mips[k] = firstMip;
+					continue;
+				}
 
-		if (dy1)
-		{
-			for (int i = y1; i <= y2; i++)
-			{
-				float step = (float)i - y1;
+				float tx = (uTex / wTexs[k]);
+				float ty = (1.0f - vTex / wTexs[k]);
+				tx -= floor(tx);
+				ty -= floor(ty);
 
-				//Calculate vertex position along the edge
-				int ax = x1 + step * daxStep;
-				int bx = x1 + step * dbxStep;
+				if (animated)
+				{
+					tx = tx * setup.frameScaleU + setup.frameOffsetU;
+					ty = ty * setup.frameScaleV + setup.frameOffsetV;
+				}
 
-				//Start UVs
-				float suTex = u1 + step * du1Step;
-				float svTex = v1 + step * dv1Step;
-				float swTex = w1 + step * dw1Step;
+				txs[k] = tx;
+				tys[k] = ty;
 
-				//End UVs
-				float euTex = u1 + step * du2Step;
-				float evTex = v1 + step * dv2Step;
-				float ewTex = w1 + step * dw2Step;
+				//int m = floor(max(0.0f, min(tex.numMips - 1.0f, 0.5f*(mipLogA - log2(tex.numMips * wTex)))));
+				mips[k] = max(0, min(setup.tex->numMips - 1, setup.tex->numMips - (int)(1000 * wTexs[k]))); //Needs adjustment
+				if (firstMip == -1) firstMip = mips[k];
+				sameMip &= mips[k] == firstMip;
+			}
 
-				//Sort along x-axis
-				if (ax > bx)
+			if (textured)
+			{
+				if (firstMip == -1) //Whole chunk is hidden
 				{
-					swap(ax, bx);
-					swap(suTex, euTex);
-					swap(svTex, evTex);
-					swap(swTex, ewTex);
+					continue;
 				}
+				for (int k = 0; k < n; k++) //Hidden pixels before the first visible one
+				{
+					if (mips[k] == -1) mips[k] = firstMip;
+				}
+			}
 
-				uTex = suTex;
-				vTex = svTex;
-				wTex = swTex;
-
-				float tStep = 1.0f / ((float)(bx - ax));
-				float tLerp = 0.0f;
+			if (!textured)
+			{
+				fill(cols, cols + n, setup.col);
+			}
+			else if (bilinear && sameMip) //Usual case; the whole chunk reads from one mip
+			{
+				sampler::SampleSpan(setup.tex->mips[firstMip], txs, tys, cols, n);
+			}
+			else if (bilinear)
+			{
+				for (int k = 0; k < n; k++)
+				{
+					cols[k] = sampler::Sample(setup.tex->mips[mips[k]], txs[k], tys[k]);
+				}
+			}
+			else
+			{
+				for (int k = 0; k < n; k++)
+				{
+					cols[k] = setup.tex->mips[mips[k]]->Sample(txs[k], tys[k]);
+					//cols[k] = mips[k] % 2 == 0 ? olc::BLACK : olc::WHITE; //View mips as stripes
+				}
+			}
 
-				for (int j = ax; j < bx; j++)
+			if (shadowed)
+			{
+				auto sunlit = [&](int k)
 				{
-					uTex = (1.0f - tLerp) * suTex + tLerp * euTex;
-					vTex = (1.0f - tLerp) * svTex + tLerp * evTex;
-					wTex = (1.0f - tLerp) * swTex + tLerp * ewTex;
+					float z = 1.0f / wTexs[k];
+					return shadows.Lit(shadowPos[0][k] * z, shadowPos[1][k] * z, shadowPos[2][k] * z);
+				};
 
-					//For some reason the image gets flipped vertically,
-					//so just do (1.0f - (v-coord)) to counteract this.
-					if (wTex > depthBuffer[i * screenW + j])
+				//Most chunks are entirely in or out of shadow, so only look up every pixel when the two ends disagree
+				bool firstLit = sunlit(0), lastLit = sunlit(n - 1);
+				for (int k = 0; k < n; k++)
+				{
+					bool inSun = firstLit == lastLit ? firstLit : k == 0 ? firstLit : k == n - 1 ? lastLit : sunlit(k);
+					if (!inSun) //Ambient only
 					{
-						DrawTexturePixel(ge, uTex, vTex, wTex, i, j, tex, tri);
+						lights[0][k] = min(lights[0][k], (float)ambientCol.r);
+						lights[1][k] = min(lights[1][k], (float)ambientCol.g);
+						lights[2][k] = min(lights[2][k], (float)ambientCol.b);
 					}
+				}
+			}
 
-					tLerp += tStep;
+			if (lit)
+			{
+				for (int k = 0; k < n; k++)
+				{
+					cols[k] = span::ApplyLight(cols[k], (uint32_t)(lights[0][k] + 0.5f), (uint32_t)(lights[1][k] + 0.5f), (uint32_t)(lights[2][k] + 0.5f));
 				}
 			}
-		}
-#pragma endregion
 
-		#pragma region DRAW BOTTOM OF TRIANGLE
+			//Chunks at the ends of the scissor area are partly outside it
+			int k0 = max(0, sx0 - j0), k1 = min(n, sx1 - j0);
+			span::Write<alphaBlend, alphaTest, cutout, emissive, fogged>(out, j0 - ax + k0, cols + k0, wTexs + k0, k1 - k0);
+		}
+	}
 
-		//Update gradients
-		dx1 = x3 - x2;
-		dy1 = y3 - y2;
-		du1 = u3 - u2;
-		dv1 = v3 - v2;
-		dw1 = w3 - w2;
+	template<size_t... Features>
+	static array<spanShader, sizeof...(Features)> MakeSpanShaderTable(index_sequence<Features...>)
+	{
+		return { { &Engine3D::ShadeSpan<CanonicalSpanFeatures(Features)>... } };
+	}
 
-		if (dy1) { daxStep = dx1 / (float)abs(dy1); }
-		if (dy2) { dbxStep = dx2 / (float)abs(dy2); }
+	//Picks the span shader for a material and works out its per-frame state
+	spanSetup GetSpanSetup(material& mat)
+	{
+		static const array<spanShader, SPAN_FEATURE_COMBINATIONS> shaders = MakeSpanShaderTable(make_index_sequence<SPAN_FEATURE_COMBINATIONS>());
 
-		du1Step = dv1Step = dw1Step = 0;
-		if (dy1) { du1Step = du1 / (float)abs(dy1); }
-		if (dy1) { dv1Step = dv1 / (float)abs(dy1); }
-		if (dy1) { dw1Step = dw1 / (float)abs(dy1); }
+		spanSetup setup;
+		setup.col = mat.col;
+		setup.emis = mat.emis;
+		int features = 0;
 
-		if (dy1)
+		if (mat.isEmissive())
 		{
-			for (int i = y2; i <= y3; i++)
-			{
-				float step1 = (float)i - y1;
-				float step2 = (float)i - y2;
-
-				//Calculate vertex position along the edge
-				int ax = x2 + step2 * daxStep;
-				int bx = x1 + step1 * dbxStep;
-
-				//Start UVs
-				float suTex = u2 + step2 * du1Step;
-				float svTex = v2 + step2 * dv1Step;
-				float swTex = w2 + step2 * dw1Step;
+			features |= SPAN_EMISSIVE;
+		}
 
-				//End UVs
-				float euTex = u1 + step1 * du2Step;
-				float evTex = v1 + step1 * dv2Step;
-				float ewTex = w1 + step1 * dw2Step;
+		if (mat.textureIndex != -1 || mat.sequenceIndex != -1)
+		{
+			features |= SPAN_TEXTURED;
+			setup.tex = mat.sequenceIndex != -1 ? &sequences[mat.sequenceIndex]->Current() : &textures[mat.textureIndex];
 
-				//Sort along x-axis
-				if (ax > bx)
+			if (mat.alphaIndex != -1)
+			{
+				//Mostly fully solid or fully clear texels; don't pay for blending, or for sorting
+				bool cutout = mat.transparency == alphaMode::CUTOUT || (mat.transparency == alphaMode::AUTO && setup.tex->binaryAlpha);
+				if (cutout)
 				{
-					swap(ax, bx);
-					swap(suTex, euTex);
-					swap(svTex, evTex);
-					swap(swTex, ewTex);
+					features |= SPAN_CUTOUT;
 				}
-
-				uTex = suTex;
-				vTex = svTex;
-				wTex = swTex;
-
-				float tStep = 1.0f / (float)(bx - ax);
-				float tLerp = 0.0f;
-
-				for (int j = ax; j < bx; j++)
+				else
 				{
-					uTex = (1.0f - tLerp) * suTex + tLerp * euTex;
-					vTex = (1.0f - tLerp) * svTex + tLerp * evTex;
-					wTex = (1.0f - tLerp) * swTex + tLerp * ewTex;
+					features |= SPAN_ALPHA_BLEND | SPAN_ALPHA_TEST;
+					setup.blended = true;
+				}
+			}
+			else if (!setup.tex->opaque)
+			{
+				features |= SPAN_ALPHA_TEST;
+			}
 
-					//BOTTOM
-					if (wTex > depthBuffer[i * screenW + j])
-					{
-						DrawTexturePixel(ge, uTex, vTex, wTex, i, j, tex, tri);
+			if (mat.startIndex < mat.endIndex) //Use animated texture
+			{
+				features |= SPAN_ANIMATED;
 
-						//int m = floor(max(0.0f, min(tex.numMips - 1.0f, 0.5f*(mipLogA - log2(tex.numMips * wTex)))));
+				int numFrames = mat.endIndex - mat.startIndex + 1;
+				int frameIndex = (int)floor(timePassed * mat.animSpeed) % (numFrames);
 
-						//Pixel p = tex.mips[m]->Sample(uTex / wTex, 1.0f - vTex / wTex);
-						//ge->Draw(j, i, p);
-						////ge->Draw(j, i, tex.mips[0]->Sample(exp2(m) * uTex / wTex, 1.0f - exp2(m)*vTex / wTex));
+				setup.frameScaleU = 1.0f / mat.xDivisions;
+				setup.frameScaleV = 1.0f / mat.yDivisions;
+				setup.frameOffsetU = setup.frameScaleU * (frameIndex % mat.xDivisions);
+				setup.frameOffsetV = setup.frameScaleV * (frameIndex / mat.yDivisions);
+			}
 
-						////ge->Draw(j, i, WHITE * (0.01f / wTex));
+			if (mat.filter == textureFilter::BILINEAR)
+			{
+				features |= SPAN_BILINEAR;
+			}
+		}
 
-						//if(round(p.a/255.0f))
-						//depthBuffer[i * screenW + j] = wTex;
-					}
+		if (fogEnabled && mat.fog)
+		{
+			features |= SPAN_FOG;
+		}
 
-					tLerp += tStep;
-				}
+		if (mat.lit && !mat.isEmissive())
+		{
+			features |= SPAN_LIT;
+			if (shadowsEnabled)
+			{
+				features |= SPAN_SHADOWED;
 			}
 		}
-#pragma endregion
 
+		setup.shade = shaders[features];
+		return setup;
 	}
 
-	void ColouredTriangle(int x1, int y1, float u1, float v1, float w1,
-		int x2, int y2, float u2, float v2, float w2,
-		int x3, int y3, float u3, float v3, float w3,
-		Pixel col, PixelGameEngine* ge)
+	//Scanline rasterizes a screen space triangle, shading each span with the material's span shader
+	void RasterTriangle(const triangle& tri, const spanSetup& setup)
 	{
-		//Sort arguments by y-position
-		if (y2 < y1)
-		{
-			swap(y1, y2);
-			swap(x1, x2);
-			swap(u1, u2);
-			swap(v1, v2);
-			swap(w1, w2);
-		}
-		if (y3 < y1)
+		int xs[3], ys[3];
+		spanVertex vs[3];
+		for (int i = 0; i < 3; i++)
 		{
-			swap(y1, y3);
-			swap(x1, x3);
-			swap(u1, u3);
-			swap(v1, v3);
-			swap(w1, w3);
+			xs[i] = tri.p[i].x;
+			ys[i] = tri.p[i].y;
+			vs[i] = { tri.t[i].u, tri.t[i].v, tri.t[i].w, (float)tri.light[i].r, (float)tri.light[i].g, (float)tri.light[i].b, tri.shadow[i].x, tri.shadow[i].y, tri.shadow[i].z };
 		}
-		if (y3 < y2)
+
+		//Sort points by y-position
+		auto swapPoints = [&](int a, int b)
 		{
-			swap(y2, y3);
-			swap(x2, x3);
-			swap(u2, u3);
-			swap(v2, v3);
-			swap(w2, w3);
-		}
+			swap(xs[a], xs[b]);
+			swap(ys[a], ys[b]);
+			swap(vs[a], vs[b]);
+		};
+		if (ys[1] < ys[0]) { swapPoints(0, 1); }
+		if (ys[2] < ys[0]) { swapPoints(0, 2); }
+		if (ys[2] < ys[1]) { swapPoints(1, 2); }
+
+		int x1 = xs[0], x2 = xs[1], x3 = xs[2];
+		int y1 = ys[0], y2 = ys[1], y3 = ys[2];
+		const spanVertex& v1 = vs[0];
+		const spanVertex& v2 = vs[1];
+		const spanVertex& v3 = vs[2];
 
 		#pragma region DRAW TOP OF TRIANGLE
 
 		int dy1 = y2 - y1;
 		int dx1 = x2 - x1;
-		float dv1 = v2 - v1;
-		float du1 = u2 - u1;
-		float dw1 = w2 - w1;
+		spanVertex dv1 = v2 - v1;
 
 		int dy2 = y3 - y1;
 		int dx2 = x3 - x1;
-		float dv2 = v3 - v1;
-		float du2 = u3 - u1;
-		float dw2 = w3 - w1;
+		spanVertex dv2 = v3 - v1;
 
-		float uTex, vTex, wTex;
-
-		float daxStep = 0, dbxStep = 0,
-			du1Step = 0, dv1Step = 0,
-			du2Step = 0, dv2Step = 0,
-			dw1Step = 0, dw2Step = 0;
+		float daxStep = 0, dbxStep = 0;
+		spanVertex dv1Step = spanVertex(), dv2Step = spanVertex();
 
 		if (dy1) { daxStep = dx1 / (float)abs(dy1); }
 		if (dy2) { dbxStep = dx2 / (float)abs(dy2); }
 
-		if (dy1) { du1Step = du1 / (float)abs(dy1); }
 		if (dy1) { dv1Step = dv1 / (float)abs(dy1); }
-		if (dy1) { dw1Step = dw1 / (float)abs(dy1); }
-
-		if (dy2) { du2Step = du2 / (float)abs(dy2); }
 		if (dy2) { dv2Step = dv2 / (float)abs(dy2); }
-		if (dy2) { dw2Step = dw2 / (float)abs(dy2); }
 
 		if (dy1)
 		{
-			for (int i = y1; i <= y2; i++)
+			for (int i = max(y1, scissor.y0); i <= min(y2, scissor.y1); i++)
 			{
 				float step = (float)i - y1;
 
@@ -1797,74 +2842,37 @@ public:
 				int ax = x1 + step * daxStep;
 				int bx = x1 + step * dbxStep;
 
-				//Start UVs
-				float suTex = u1 + step * du1Step;
-				float svTex = v1 + step * dv1Step;
-				float swTex = w1 + step * dw1Step;
-
-				//End UVs
-				float euTex = u1 + step * du2Step;
-				float evTex = v1 + step * dv2Step;
-				float ewTex = w1 + step * dw2Step;
+				spanVertex sv = v1 + dv1Step * step;
+				spanVertex ev = v1 + dv2Step * step;
 
 				//Sort along x-axis
 				if (ax > bx)
 				{
 					swap(ax, bx);
-					swap(suTex, euTex);
-					swap(svTex, evTex);
-					swap(swTex, ewTex);
+					swap(sv, ev);
 				}
 
-				uTex = suTex;
-				vTex = svTex;
-				wTex = swTex;
-
-				float tStep = 1.0f / ((float)(bx - ax));
-				float tLerp = 0.0f;
-
-				for (int j = ax; j < bx; j++)
-				{
-					uTex = (1.0f - tLerp) * suTex + tLerp * euTex;
-					vTex = (1.0f - tLerp) * svTex + tLerp * evTex;
-					wTex = (1.0f - tLerp) * swTex + tLerp * ewTex;
-
-					//For some reason the image gets flipped vertically,
-					//so just do (1.0f - (v-coord)) to counteract this.
-					if (wTex > depthBuffer[i * screenW + j])
-					{
-						ge->Draw(j, i, col);
-						depthBuffer[i * screenW + j] = wTex;
-						//LitPixel(i, j, uTex, vTex, wTex, tex, t, ge);
-						//depthBuffer[i * screenW + j] = wTex;
-					}
-
-					tLerp += tStep;
-				}
+				(this->*setup.shade)(setup, i, ax, bx, sv, ev);
 			}
 		}
 #pragma endregion
 
-#pragma region DRAW BOTTOM OF TRIANGLE
+		#pragma region DRAW BOTTOM OF TRIANGLE
 
 		//Update gradients
 		dx1 = x3 - x2;
 		dy1 = y3 - y2;
-		du1 = u3 - u2;
 		dv1 = v3 - v2;
-		dw1 = w3 - w2;
 
 		if (dy1) { daxStep = dx1 / (float)abs(dy1); }
 		if (dy2) { dbxStep = dx2 / (float)abs(dy2); }
 
-		du1Step = dv1Step = dw1Step = 0;
-		if (dy1) { du1Step = du1 / (float)abs(dy1); }
+		dv1Step = spanVertex();
 		if (dy1) { dv1Step = dv1 / (float)abs(dy1); }
-		if (dy1) { dw1Step = dw1 / (float)abs(dy1); }
 
 		if (dy1)
 		{
-			for (int i = y2; i <= y3; i++)
+			for (int i = max(y2, scissor.y0); i <= min(y3, scissor.y1); i++)
 			{
 				float step1 = (float)i - y1;
 				float step2 = (float)i - y2;
@@ -1873,48 +2881,252 @@ public:
 				int ax = x2 + step2 * daxStep;
 				int bx = x1 + step1 * dbxStep;
 
-				//Start UVs
-				float suTex = u2 + step2 * du1Step;
-				float svTex = v2 + step2 * dv1Step;
-				float swTex = w2 + step2 * dw1Step;
-
-				//End UVs
-				float euTex = u1 + step1 * du2Step;
-				float evTex = v1 + step1 * dv2Step;
-				float ewTex = w1 + step1 * dw2Step;
+				spanVertex sv = v2 + dv1Step * step2;
+				spanVertex ev = v1 + dv2Step * step1;
 
 				//Sort along x-axis
 				if (ax > bx)
 				{
 					swap(ax, bx);
-					swap(suTex, euTex);
-					swap(svTex, evTex);
-					swap(swTex, ewTex);
+					swap(sv, ev);
 				}
 
-				uTex = suTex;
-				vTex = svTex;
-				wTex = swTex;
+				(this->*setup.shade)(setup, i, ax, bx, sv, ev);
+			}
+		}
+#pragma endregion
+
+	}
+
+	//Everything besides the scene itself that changes what the 3D pass draws
+	vector<float> ViewKey()
+	{
+		vector<float> key(&matView.m[0][0], &matView.m[0][0] + 16);
+		key.insert(key.end(), &matProj.m[0][0], &matProj.m[0][0] + 16);
+		key.insert(key.end(), {
+			(float)renderW, (float)renderH,
+			(float)fogEnabled, fogStart, fogEnd, (float)fogCol.r, (float)fogCol.g, (float)fogCol.b,
+			(float)shadowsEnabled, sunDir.x, sunDir.y, sunDir.z,
+			(float)skyCol.r, (float)skyCol.g, (float)skyCol.b, (float)bloomStrength
+		});
+		return key;
+	}
+
+	//Area of the render target covering some world space points. All of it if any are behind the camera
+	screenRect ProjectedBounds(const vec3d* pts, int n)
+	{
+		screenRect bounds;
+		for (int i = 0; i < n; i++)
+		{
+			vec3d projected = pts[i] * matViewProj;
+			if (projected.w < 0.1f) //Clip space w is view space depth
+			{
+				return screenRect(0, 0, renderW - 1, renderH - 1);
+			}
+
+			bounds.add((1.0f - projected.x / projected.w) * 0.5f * renderW, (1.0f - projected.y / projected.w) * 0.5f * renderH);
+		}
+		return bounds;
+	}
+
+	//Changes the size the 3D pass is drawn at, up to the screen size
+	void SetRenderSize(int w, int h)
+	{
+		renderW = min(w, screenW);
+		renderH = min(h, screenH);
+		bloom = make_unique<Bloom>(renderW, renderH, workers);
+	}
 
-				float tStep = 1.0f / (float)(bx - ax);
-				float tLerp = 0.0f;
+	//Clips a projected triangle against the screen edges and rasterizes what is left of it
+	void ClipAndRasterTriangle(const triangle& triToRaster, const vector<spanSetup>& matSetups)
+	{
+		#pragma region SCREEN CLIPPING
+		//Clip triangles against all four screen edges
+		triangle clipped[2];
+		list<triangle> tris;
+		tris.push_back(triToRaster);
+		int newTris = 1;
+
+		for (int p = 0; p < 4; p++)
+		{
+			int trisToAdd = 0;
+			while (newTris > 0)
+			{
+				triangle test = tris.front();
+				tris.pop_front();
+				newTris--;
+
+				//Clip in Screen Space along each of the screen border planes
+				switch (p)
+				{
+				case 0:
+					trisToAdd = ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, test, clipped[0], clipped[1]);
+					break;
+				case 1:
+					trisToAdd = ClipAgainstPlane({ 0.0f, (float)renderH-1, 0.0f }, { 0.0f, -1.0f, 0.0f }, test, clipped[0], clipped[1]);
+					break;
+				case 2:
+					trisToAdd = ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]);
+					break;
+				case 3:
+					trisToAdd = ClipAgainstPlane({ (float)renderW-1, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]);
+					break;
+				}
 
-				for (int j = ax; j < bx; j++)
+				//Clipping may yield many triangles, which must be added to the back of the queue
+				//to be tested for clipping against the other sides of the screen border
+				for (int t = 0; t < trisToAdd; t++)
 				{
-					uTex = (1.0f - tLerp) * suTex + tLerp * euTex;
-					vTex = (1.0f - tLerp) * svTex + tLerp * evTex;
-					wTex = (1.0f - tLerp) * swTex + tLerp * ewTex;
+					tris.push_back(clipped[t]);
+				}
+			}
+			newTris = (int)tris.size();
+		}
+		#pragma endregion
 
-					if (wTex > depthBuffer[i * screenW + j])
+		#pragma region RASTERIZE TRIANGLES
+		for (triangle& t : tris)
+		{
+			RasterTriangle(t, matSetups[t.matIndex]);
+
+			//Center points
+			vec2d center(t.p[0].x + t.p[1].x + t.p[2].x, t.p[0].y + t.p[1].y + t.p[2].y);
+			center /= 3;
+			//ge->DrawString(center.x, center.y, to_string(t.matIndex), BLACK);
+			//ge->DrawString(center.x, center.y, to_string(depthBuffer[(int)center.x*screenW + (int)center.y]), WHITE);
+			//Wireframe
+			//ge->DrawTriangle(t.p[0].x, t.p[0].y, t.p[1].x, t.p[1].y, t.p[2].x, t.p[2].y, GREEN);
+		}
+
+		//TODO: Particles
+		//for(particle& p : particles) ...
+		#pragma endregion
+	}
+
+	//Average colour of the sky near the horizon, which is where geometry far enough away to be fully fogged is mostly seen against it
+	Pixel SkyHorizonColour() const
+	{
+		const material* mat = skyMaterial != -1 ? &materials[skyMaterial] : nullptr;
+		if (!mat)
+		{
+			return skyCol;
+		}
+		Sprite* tex = mat->textureIndex != -1 ? textures[mat->textureIndex].mips[0] : nullptr;
+		if (!tex || tex->width == 0 || tex->height == 0)
+		{
+			return mat->col;
+		}
+
+		//Within 10 degrees of the horizon, which is halfway down the equirectangular map (see DrawSky())
+		int y0 = max(0, (int)(tex->height * (0.5f - 10.0f / 180.0f)));
+		int y1 = min(tex->height - 1, (int)(tex->height * (0.5f + 10.0f / 180.0f)));
+		uint64_t r = 0, g = 0, b = 0;
+		for (int y = y0; y <= y1; y++)
+		{
+			for (int x = 0; x < tex->width; x++)
+			{
+				Pixel p = tex->pColData[y * tex->width + x];
+				r += p.r;
+				g += p.g;
+				b += p.b;
+			}
+		}
+		uint64_t n = (uint64_t)(y1 - y0 + 1) * tex->width;
+		return Pixel((uint8_t)(r / n), (uint8_t)(g / n), (uint8_t)(b / n));
+	}
+
+	//Fills every pixel in an area that no geometry has been drawn to with the sky, looked up from the direction through the pixel
+	//The direction is linear across the screen, but the texture coordinates aren't, so they're worked out exactly every 8 pixels and interpolated between
+	void DrawSky(const screenRect& area)
+	{
+		const material* mat = skyMaterial != -1 ? &materials[skyMaterial] : nullptr;
+		Sprite* tex = mat && mat->textureIndex != -1 ? textures[mat->textureIndex].mips[0] : nullptr;
+		Pixel col = mat ? mat->col : skyCol;
+		bool bilinear = mat && mat->filter == textureFilter::BILINEAR;
+
+		//Camera axes in world space, and how far a pixel moves the direction along them (undoing the projection's x/y flip)
+		vec3d right(matCam.m[0][0], matCam.m[0][1], matCam.m[0][2]);
+		vec3d up(matCam.m[1][0], matCam.m[1][1], matCam.m[1][2]);
+		vec3d forward(matCam.m[2][0], matCam.m[2][1], matCam.m[2][2]);
+		float xStep = -2.0f / (renderW * matProj.m[0][0]);
+		float yStep = -2.0f / (renderH * matProj.m[1][1]);
+		vec3d topLeft = forward + right * (1.0f / matProj.m[0][0]) + up * (1.0f / matProj.m[1][1]);
+
+		//Equirectangular: longitude across, latitude down
+		auto skyUV = [&](const vec3d& dir, float& u, float& v)
+		{
+			u = 0.5f + atan2f(dir.x, dir.z) / TWO_PI;
+			v = 0.5f - asinf(max(-1.0f, min(1.0f, dir.y / dir.length()))) / PI;
+		};
+
+		workers.ParallelFor(area.y1 - area.y0 + 1, [&](int y0, int y1)
+		{
+			const int chunkSize = 8;
+
+			for (int i = area.y0 + y0; i < area.y0 + y1; i++)
+			{
+				Pixel* row = drawTarget + i * renderW;
+				const float* depthRow = depthBuffer + i * renderW;
+				vec3d rowDir = topLeft + up * ((i + 0.5f) * yStep);
+
+				//Chunks stay on the same columns whatever the area, so redrawing part of the sky matches the rest of it
+				int start = area.x0 / chunkSize * chunkSize;
+				float u1 = 0.0f, v1 = 0.0f;
+				skyUV(rowDir + right * ((start + 0.5f) * xStep), u1, v1);
+
+				for (int j0 = start; j0 <= area.x1; j0 += chunkSize)
+				{
+					int n = min(chunkSize, renderW - j0);
+
+					float u0 = u1, v0 = v1;
+					skyUV(rowDir + right * ((j0 + n + 0.5f) * xStep), u1, v1);
+
+					//Chunks at the ends of the area are partly outside it
+					int k0 = max(0, area.x0 - j0), k1 = min(n, area.x1 + 1 - j0);
+
+					bool empty = false;
+					for (int k = k0; k < k1; k++)
+					{
+						empty |= depthRow[j0 + k] == 0.0f;
+					}
+					if (!empty)
 					{
-						ge->Draw(j, i, col);
-						depthBuffer[i * screenW + j] = wTex;
+						continue;
+					}
+
+					if (!tex)
+					{
+						for (int k = k0; k < k1; k++)
+						{
+							if (depthRow[j0 + k] == 0.0f) row[j0 + k] = col;
+						}
+						continue;
 					}
 
-					tLerp += tStep;
+					//Take the short way round where the longitude wraps
+					float du = u1 - u0;
+					du -= floor(du + 0.5f);
+					float dv = v1 - v0;
+
+					for (int k = k0; k < k1; k++)
+					{
+						if (depthRow[j0 + k] != 0.0f)
+						{
+							continue;
+						}
+
+						float t = k / (float)n;
+						float u = u0 + du * t;
+						u -= floor(u);
+						float v = v0 + dv * t;
+
+						Pixel p = bilinear ? sampler::Sample(tex, u, v) : tex->Sample(u, v);
+						p.a = 255;
+						row[j0 + k] = p;
+					}
 				}
 			}
-		}
-#pragma endregion
+		}, 16);
 	}
+
 };
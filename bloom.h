@@ -0,0 +1,365 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include "simd.h"
+#include "workerPool.h"
+
+using namespace std;
+using namespace olc;
+
+//Glow around emissive surfaces
+//The rasterizer leaves the emissive colour of every emissive pixel it draws in a buffer, along with its depth. Those that are
+//still visible once the frame is drawn are downsampled into a pyramid of half size images, each blurred a little, then all of
+//them are scaled back up into one another and added onto the frame. The small levels give the wide glow for next to nothing
+class Bloom
+{
+private:
+	struct level
+	{
+		int w = 0, h = 0;
+		vector<Pixel> img, tmp;
+	};
+
+	int width, height;
+	vector<level> levels;
+	WorkerPool& pool;
+
+	//Below this many pixels a pass is done on the calling thread
+	static const int minPixelsPerThread = 16384;
+
+	#pragma region SCALAR KERNELS
+	//Packed pixel arithmetic, two channels at a time: 0x00BB00RR and 0x00AA00GG, leaving 8 bits of headroom per channel
+	static inline uint32_t Lo(uint32_t p) { return p & 0x00FF00FF; }
+	static inline uint32_t Hi(uint32_t p) { return (p >> 8) & 0x00FF00FF; }
+	static inline uint32_t Pack(uint32_t lo, uint32_t hi) { return (lo & 0x00FF00FF) | ((hi & 0x00FF00FF) << 8); }
+
+	//1 4 6 4 1 binomial kernel
+	static inline uint32_t Blur5(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e)
+	{
+		uint32_t lo = (Lo(a) + Lo(e) + 4 * (Lo(b) + Lo(d)) + 6 * Lo(c)) >> 4;
+		uint32_t hi = (Hi(a) + Hi(e) + 4 * (Hi(b) + Hi(d)) + 6 * Hi(c)) >> 4;
+		return Pack(lo, hi);
+	}
+
+	static inline uint32_t Average4(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+	{
+		return Pack((Lo(a) + Lo(b) + Lo(c) + Lo(d) + 0x00020002) >> 2, (Hi(a) + Hi(b) + Hi(c) + Hi(d) + 0x00020002) >> 2);
+	}
+
+	//(3a + b) / 4, the weights for sampling halfway between the centers of two pixels of a half size image
+	static inline uint32_t Lerp31(uint32_t a, uint32_t b)
+	{
+		return Pack((3 * Lo(a) + Lo(b)) >> 2, (3 * Hi(a) + Hi(b)) >> 2);
+	}
+
+	//dst + src * strength / 256, saturating each channel
+	static inline uint32_t AddScaled(uint32_t dst, uint32_t src, uint32_t strength)
+	{
+		uint32_t res = 0;
+		for (int ch = 0; ch < 32; ch += 8)
+		{
+			uint32_t v = ((dst >> ch) & 0xFF) + ((((src >> ch) & 0xFF) * strength) >> 8);
+			res |= min(v, 255u) << ch;
+		}
+		return res;
+	}
+	#pragma endregion
+
+	//Emissive pixels that are still visible, averaged in 2x2 blocks into the first level
+	void Extract(const Pixel* emissive, const float* emissiveDepth, const float* depth)
+	{
+		level& dst = levels[0];
+
+		pool.ParallelFor(dst.h, [&](int y0, int y1)
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				const int r0 = (2 * y) * width, r1 = r0 + width;
+				Pixel* out = dst.img.data() + y * dst.w;
+
+				auto visible = [&](int i) { return emissiveDepth[i] != 0.0f && emissiveDepth[i] == depth[i] ? emissive[i].n : 0u; };
+
+				int x = 0;
+#ifdef CV_SSE2
+				const __m128 zero = _mm_setzero_ps();
+				for (; x + 4 <= dst.w; x += 4)
+				{
+					//Keep only the pixels nothing has since been drawn over
+					__m128i rows[2][2];
+					for (int r = 0; r < 2; r++)
+					{
+						int i = (r ? r1 : r0) + 2 * x;
+						for (int half = 0; half < 2; half++)
+						{
+							__m128 ed = _mm_loadu_ps(emissiveDepth + i + 4 * half);
+							__m128 mask = _mm_and_ps(_mm_cmpeq_ps(ed, _mm_loadu_ps(depth + i + 4 * half)), _mm_cmpneq_ps(ed, zero));
+							rows[r][half] = _mm_and_si128(_mm_loadu_si128((const __m128i*)(emissive + i + 4 * half)), _mm_castps_si128(mask));
+						}
+					}
+
+					//Split into even and odd columns, then average the four of each block
+					__m128i avg[2];
+					for (int r = 0; r < 2; r++)
+					{
+						__m128 a = _mm_castsi128_ps(rows[r][0]), b = _mm_castsi128_ps(rows[r][1]);
+						__m128i even = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+						__m128i odd  = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+						avg[r] = _mm_avg_epu8(even, odd);
+					}
+					_mm_storeu_si128((__m128i*)(out + x), _mm_avg_epu8(avg[0], avg[1]));
+				}
+#endif
+				for (; x < dst.w; x++)
+				{
+					int i = r0 + 2 * x;
+					out[x].n = Average4(visible(i), visible(i + 1), visible(i + width), visible(i + width + 1));
+				}
+			}
+		}, minPixelsPerThread / max(1, dst.w));
+	}
+
+	void Downsample(const level& src, level& dst)
+	{
+		pool.ParallelFor(dst.h, [&](int y0, int y1)
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				const Pixel* in0 = src.img.data() + (2 * y) * src.w;
+				const Pixel* in1 = in0 + src.w;
+				Pixel* out = dst.img.data() + y * dst.w;
+
+				int x = 0;
+#ifdef CV_SSE2
+				for (; x + 4 <= dst.w; x += 4)
+				{
+					__m128i avg[2];
+					for (int r = 0; r < 2; r++)
+					{
+						const Pixel* in = r ? in1 : in0;
+						__m128 a = _mm_loadu_ps((const float*)(in + 2 * x));
+						__m128 b = _mm_loadu_ps((const float*)(in + 2 * x + 4));
+						avg[r] = _mm_avg_epu8(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+											  _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+					}
+					_mm_storeu_si128((__m128i*)(out + x), _mm_avg_epu8(avg[0], avg[1]));
+				}
+#endif
+				for (; x < dst.w; x++)
+				{
+					out[x].n = Average4(in0[2 * x].n, in0[2 * x + 1].n, in1[2 * x].n, in1[2 * x + 1].n);
+				}
+			}
+		}, minPixelsPerThread / max(1, dst.w));
+	}
+
+#ifdef CV_SSE2
+	//1 4 6 4 1 over four pixels at a time, with the five taps already loaded
+	static inline __m128i Blur5x4(__m128i a, __m128i b, __m128i c, __m128i d, __m128i e)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i res[2];
+		for (int half = 0; half < 2; half++)
+		{
+			auto widen = [&](__m128i p) { return half ? _mm_unpackhi_epi8(p, zero) : _mm_unpacklo_epi8(p, zero); };
+			__m128i c16 = widen(c);
+			__m128i sum = _mm_add_epi16(widen(a), widen(e));
+			sum = _mm_add_epi16(sum, _mm_slli_epi16(_mm_add_epi16(widen(b), widen(d)), 2));
+			sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_slli_epi16(c16, 2), _mm_slli_epi16(c16, 1)));
+			res[half] = _mm_srli_epi16(sum, 4);
+		}
+		return _mm_packus_epi16(res[0], res[1]);
+	}
+#endif
+
+	//Separable blur, rows into tmp then columns back into img. Edges are clamped
+	void Blur(level& lv)
+	{
+		const int w = lv.w, h = lv.h;
+
+		pool.ParallelFor(h, [&](int y0, int y1)
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				const Pixel* in = lv.img.data() + y * w;
+				Pixel* out = lv.tmp.data() + y * w;
+				auto at = [&](int x) { return in[max(0, min(w - 1, x))].n; };
+
+				int x = 0;
+				for (; x < min(2, w); x++)
+				{
+					out[x].n = Blur5(at(x - 2), at(x - 1), at(x), at(x + 1), at(x + 2));
+				}
+#ifdef CV_SSE2
+				for (; x + 4 + 2 <= w; x += 4)
+				{
+					const __m128i* p = (const __m128i*)(in + x);
+					_mm_storeu_si128((__m128i*)(out + x), Blur5x4(_mm_loadu_si128((const __m128i*)(in + x - 2)), _mm_loadu_si128((const __m128i*)(in + x - 1)),
+																	_mm_loadu_si128(p),
+																	_mm_loadu_si128((const __m128i*)(in + x + 1)), _mm_loadu_si128((const __m128i*)(in + x + 2))));
+				}
+#endif
+				for (; x < w; x++)
+				{
+					out[x].n = Blur5(at(x - 2), at(x - 1), at(x), at(x + 1), at(x + 2));
+				}
+			}
+		}, minPixelsPerThread / max(1, w));
+
+		pool.ParallelFor(h, [&](int y0, int y1)
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				const Pixel* rows[5];
+				for (int k = 0; k < 5; k++)
+				{
+					rows[k] = lv.tmp.data() + max(0, min(h - 1, y + k - 2)) * w;
+				}
+				Pixel* out = lv.img.data() + y * w;
+
+				int x = 0;
+#ifdef CV_SSE2
+				for (; x + 4 <= w; x += 4)
+				{
+					_mm_storeu_si128((__m128i*)(out + x), Blur5x4(_mm_loadu_si128((const __m128i*)(rows[0] + x)), _mm_loadu_si128((const __m128i*)(rows[1] + x)),
+																	_mm_loadu_si128((const __m128i*)(rows[2] + x)),
+																	_mm_loadu_si128((const __m128i*)(rows[3] + x)), _mm_loadu_si128((const __m128i*)(rows[4] + x))));
+				}
+#endif
+				for (; x < w; x++)
+				{
+					out[x].n = Blur5(rows[0][x].n, rows[1][x].n, rows[2][x].n, rows[3][x].n, rows[4][x].n);
+				}
+			}
+		}, minPixelsPerThread / max(1, w));
+	}
+
+	//Bilinearly scales src up to twice its size, adding (strength / 256) of it onto dst
+	void UpsampleAdd(const level& src, Pixel* dst, int dw, int dh, int strength)
+	{
+		const int sw = src.w, sh = src.h;
+
+		pool.ParallelFor(dh, [&](int y0, int y1)
+		{
+			vector<Pixel> rowBuffer(sw);
+			Pixel* row = rowBuffer.data();
+
+			for (int y = y0; y < y1; y++)
+			{
+				//Blend the two nearest source rows
+				int k = min(y >> 1, sh - 1);
+				int kn = (y & 1) ? min(k + 1, sh - 1) : max(k - 1, 0);
+				const Pixel* a = src.img.data() + k * sw;
+				const Pixel* b = src.img.data() + kn * sw;
+				int x = 0;
+#ifdef CV_SSE2
+				//(3a + b) / 4 as avg(a, avg(a, b)), rounding aside
+				for (; x + 4 <= sw; x += 4)
+				{
+					__m128i pa = _mm_loadu_si128((const __m128i*)(a + x));
+					__m128i pb = _mm_loadu_si128((const __m128i*)(b + x));
+					_mm_storeu_si128((__m128i*)(row + x), _mm_avg_epu8(pa, _mm_avg_epu8(pa, pb)));
+				}
+#endif
+				for (; x < sw; x++)
+				{
+					row[x].n = Lerp31(a[x].n, b[x].n);
+				}
+
+				//Then the two nearest columns
+				Pixel* out = dst + y * dw;
+				auto expand = [&](int x)
+				{
+					int kx = min(x >> 1, sw - 1);
+					int kxn = (x & 1) ? min(kx + 1, sw - 1) : max(kx - 1, 0);
+					out[x].n = AddScaled(out[x].n, Lerp31(row[kx].n, row[kxn].n), strength);
+				};
+
+				x = 0;
+				for (; x < min(2, dw); x++)
+				{
+					expand(x);
+				}
+#ifdef CV_SSE2
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i scale = _mm_set1_epi16((short)strength);
+				//Eight output pixels from source pixels kx-1 to kx+4
+				for (; x + 8 <= dw && (x >> 1) + 5 <= sw; x += 8)
+				{
+					int kx = x >> 1;
+					__m128i l = _mm_loadu_si128((const __m128i*)(row + kx - 1));
+					__m128i c = _mm_loadu_si128((const __m128i*)(row + kx));
+					__m128i r = _mm_loadu_si128((const __m128i*)(row + kx + 1));
+
+					__m128i outs[2];
+					for (int half = 0; half < 2; half++)
+					{
+						auto widen = [&](__m128i p) { return half ? _mm_unpackhi_epi8(p, zero) : _mm_unpacklo_epi8(p, zero); };
+						__m128i c3 = _mm_add_epi16(widen(c), _mm_slli_epi16(widen(c), 1));
+						__m128i even = _mm_srli_epi16(_mm_add_epi16(c3, widen(l)), 2);
+						__m128i odd  = _mm_srli_epi16(_mm_add_epi16(c3, widen(r)), 2);
+						even = _mm_srli_epi16(_mm_mullo_epi16(even, scale), 8);
+						odd  = _mm_srli_epi16(_mm_mullo_epi16(odd, scale), 8);
+
+						//Interleave back into pixel order: even, odd, even, odd
+						__m128i packedEven = _mm_packus_epi16(even, even);
+						__m128i packedOdd  = _mm_packus_epi16(odd, odd);
+						outs[half] = _mm_unpacklo_epi32(packedEven, packedOdd);
+					}
+
+					__m128i* o = (__m128i*)(out + x);
+					_mm_storeu_si128(o,     _mm_adds_epu8(_mm_loadu_si128(o),     outs[0]));
+					_mm_storeu_si128(o + 1, _mm_adds_epu8(_mm_loadu_si128(o + 1), outs[1]));
+				}
+#endif
+				for (; x < dw; x++)
+				{
+					expand(x);
+				}
+			}
+		}, minPixelsPerThread / max(1, dw));
+	}
+
+public:
+	Bloom(int width, int height, WorkerPool& pool, int numLevels = 5)
+		: width(width), height(height), pool(pool)
+	{
+		int w = width / 2, h = height / 2;
+		for (int l = 0; l < numLevels && w >= 4 && h >= 4; l++)
+		{
+			level lv;
+			lv.w = w;
+			lv.h = h;
+			lv.img.resize(w * h);
+			lv.tmp.resize(w * h);
+			levels.push_back(lv);
+
+			w /= 2;
+			h /= 2;
+		}
+	}
+
+	//Adds the glow of the visible emissive pixels onto target, which is the same size as the buffers
+	//strength: 256 adds the blurred emissive colour at full brightness
+	void Apply(Pixel* target, const Pixel* emissive, const float* emissiveDepth, const float* depth, int strength)
+	{
+		if (levels.empty())
+		{
+			return;
+		}
+
+		Extract(emissive, emissiveDepth, depth);
+		for (int l = 1; l < (int)levels.size(); l++)
+		{
+			Downsample(levels[l - 1], levels[l]);
+		}
+
+		//Blur from the bottom of the pyramid up, adding each level into the one above it
+		Blur(levels.back());
+		for (int l = (int)levels.size() - 2; l >= 0; l--)
+		{
+			Blur(levels[l]);
+			UpsampleAdd(levels[l + 1], levels[l].img.data(), levels[l].w, levels[l].h, 256);
+		}
+
+		UpsampleAdd(levels[0], target, width, height, strength);
+	}
+};
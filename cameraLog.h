@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//Where a path was drawn on one frame
+struct pathFrame
+{
+	int32_t currInfoPt;
+	int32_t isMoving;
+	float posT;
+	float drawLength; //Distance along the path, see path::Interpolate()
+};
+
+//Everything about the camera and the paths that a frame was drawn from
+struct cameraFrame
+{
+	float dt;	//How long the frame took when it was recorded
+	float time; //Animation time it was drawn at
+	float pos[3];
+	float yaw, tilt, fov;
+	vector<pathFrame> paths;
+};
+
+//Camera logs are a header ("CVCL", version, number of paths), then one fixed size record per frame:
+//the cameraFrame fields in order, then a pathFrame per path. Everything is 4 bytes, in the machine's byte order
+static const char cameraLogMagic[4] = { 'C', 'V', 'C', 'L' };
+static const uint32_t cameraLogVersion = 1;
+
+//Writes frames to a camera log as they are drawn
+class CameraRecorder
+{
+private:
+	ofstream file;
+	uint32_t pathCount = 0;
+
+public:
+	bool Start(const string& fileName, uint32_t numPaths)
+	{
+		file.open(fileName, ios::binary | ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		pathCount = numPaths;
+		file.write(cameraLogMagic, 4);
+		file.write((const char*)&cameraLogVersion, 4);
+		file.write((const char*)&pathCount, 4);
+		return true;
+	}
+
+	void Write(const cameraFrame& f)
+	{
+		if (!file.is_open())
+		{
+			return;
+		}
+
+		file.write((const char*)&f.dt, 4);
+		file.write((const char*)&f.time, 4);
+		file.write((const char*)f.pos, 12);
+		file.write((const char*)&f.yaw, 4);
+		file.write((const char*)&f.tilt, 4);
+		file.write((const char*)&f.fov, 4);
+		for (uint32_t i = 0; i < pathCount; i++)
+		{
+			pathFrame p = i < f.paths.size() ? f.paths[i] : pathFrame{ 0, 0, 0.0f, 0.0f };
+			file.write((const char*)&p, sizeof(pathFrame));
+		}
+	}
+
+	void Stop()
+	{
+		file.close();
+	}
+
+	bool Recording() const
+	{
+		return file.is_open();
+	}
+};
+
+//Reads a camera log back, a frame at a time, and keeps how long each frame took to draw again
+class CameraReplay
+{
+private:
+	vector<cameraFrame> frames;
+	size_t next = 0;
+	vector<float> frameMs;
+
+public:
+	bool Load(const string& fileName)
+	{
+		frames.clear();
+		frameMs.clear();
+		next = 0;
+
+		ifstream file(fileName, ios::binary);
+		char magic[4];
+		uint32_t version, pathCount;
+		if (!file.read(magic, 4) || !equal(magic, magic + 4, cameraLogMagic)
+			|| !file.read((char*)&version, 4) || version != cameraLogVersion
+			|| !file.read((char*)&pathCount, 4))
+		{
+			return false;
+		}
+
+		cameraFrame f;
+		f.paths.resize(pathCount);
+		while (file.read((char*)&f.dt, 4) && file.read((char*)&f.time, 4) && file.read((char*)f.pos, 12)
+			&& file.read((char*)&f.yaw, 4) && file.read((char*)&f.tilt, 4) && file.read((char*)&f.fov, 4)
+			&& (pathCount == 0 || file.read((char*)f.paths.data(), pathCount * sizeof(pathFrame))))
+		{
+			frames.push_back(f);
+		}
+		return !frames.empty();
+	}
+
+	//The next frame to draw, or nullptr once they have all been drawn
+	const cameraFrame* Next()
+	{
+		return next < frames.size() ? &frames[next++] : nullptr;
+	}
+
+	//How long the frame last returned by Next() took
+	void AddTiming(float ms)
+	{
+		frameMs.push_back(ms);
+	}
+
+	//One line per frame (frame, recorded ms, replayed ms), then a summary to the console
+	void WriteTimings(const string& fileName) const
+	{
+		ofstream out(fileName);
+		out << "frame,recordedMs,replayMs\n";
+		for (size_t i = 0; i < frameMs.size(); i++)
+		{
+			out << i << "," << frames[i].dt * 1000.0f << "," << frameMs[i] << "\n";
+		}
+
+		if (frameMs.empty())
+		{
+			return;
+		}
+		vector<float> sorted = frameMs;
+		sort(sorted.begin(), sorted.end());
+		float total = 0.0f;
+		for (float ms : sorted)
+		{
+			total += ms;
+		}
+		printf("Replayed %d frames: mean %.2fms, median %.2fms, 95th percentile %.2fms, worst %.2fms\n", (int)sorted.size(),
+			total / (float)sorted.size(), sorted[sorted.size() / 2], sorted[min(sorted.size() - 1, sorted.size() * 95 / 100)], sorted.back());
+	}
+};
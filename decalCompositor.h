@@ -0,0 +1,202 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include "simd.h"
+#include "span.h"
+#include <chrono>
+#include <vector>
+
+using namespace std;
+using namespace olc;
+
+//Draws overlays into the frame on the CPU, instead of leaving them for the renderer to draw as decals with OpenGL
+//That way they end up in the frame's pixels, and their cost can be timed with the rest of the frame
+//Sprites can be drawn straight from their pixels, with no decal (or GPU texture) made for them at all, or a layer's queued decals can be drawn
+//Of those, only upright, unwarped quads in the normal blend mode are drawn; anything else is left queued
+class DecalCompositor
+{
+private:
+	//A decal quad, in pixels, with the part of its sprite it shows, in texels
+	struct quad
+	{
+		float x0, y0, x1, y1;
+		float u0, v0, u1, v1;
+		Pixel tint;
+	};
+
+	vector<int> cols; //Texel column for each pixel column of the current quad
+	float ms = 0.0f; //Time spent drawing since the last Composite()
+
+	static bool ToQuad(const DecalInstance& di, int screenW, int screenH, quad& q)
+	{
+		if (di.points != 4 || di.mode != DecalMode::NORMAL || di.decal == nullptr || di.decal->sprite == nullptr)
+		{
+			return false;
+		}
+
+		//Corners go top left, bottom left, bottom right, top right, as PixelGameEngine::DrawDecal() lays them out
+		const vector<vf2d>& p = di.pos;
+		const vector<vf2d>& uv = di.uv;
+		if (p[0].x != p[1].x || p[2].x != p[3].x || p[0].y != p[3].y || p[1].y != p[2].y
+			|| uv[0].x != uv[1].x || uv[2].x != uv[3].x || uv[0].y != uv[3].y || uv[1].y != uv[2].y
+			|| di.w[0] != 1.0f || di.w[1] != 1.0f || di.w[2] != 1.0f || di.w[3] != 1.0f
+			|| di.tint[0] != di.tint[1] || di.tint[0] != di.tint[2] || di.tint[0] != di.tint[3])
+		{
+			return false;
+		}
+
+		//Back from normalized device coordinates to pixels, and from normalized texture coordinates to texels
+		const Sprite* spr = di.decal->sprite;
+		q.x0 = (p[0].x + 1.0f) * 0.5f * screenW;
+		q.x1 = (p[2].x + 1.0f) * 0.5f * screenW;
+		q.y0 = (1.0f - p[0].y) * 0.5f * screenH;
+		q.y1 = (1.0f - p[2].y) * 0.5f * screenH;
+		q.u0 = uv[0].x * spr->width;
+		q.u1 = uv[2].x * spr->width;
+		q.v0 = uv[0].y * spr->height;
+		q.v1 = uv[2].y * spr->height;
+		q.tint = di.tint[0];
+		return true;
+	}
+
+	//Multiplies every channel, alpha included, by the tint's, as the renderer does
+	static inline Pixel Tint(Pixel p, Pixel t)
+	{
+		p.r = (p.r * (t.r + (t.r >> 7))) >> 8; //0-255 -> 0-256, as in span::ApplyLight()
+		p.g = (p.g * (t.g + (t.g >> 7))) >> 8;
+		p.b = (p.b * (t.b + (t.b >> 7))) >> 8;
+		p.a = (p.a * (t.a + (t.a >> 7))) >> 8;
+		return p;
+	}
+
+#ifdef CV_SSE2
+	//Tint() then span::BlendAlpha() on four pixels at a time, with each channel widened to 16 bits
+	static inline __m128i TintBlend4(__m128i src, __m128i dst, __m128i tint16)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i full = _mm_set1_epi16(256);
+		__m128i res[2];
+		for (int half = 0; half < 2; half++)
+		{
+			auto widen = [&](__m128i p) { return half ? _mm_unpackhi_epi8(p, zero) : _mm_unpacklo_epi8(p, zero); };
+			__m128i s = _mm_srli_epi16(_mm_mullo_epi16(widen(src), tint16), 8);
+			__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			a = _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+			__m128i sum = _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(widen(dst), _mm_sub_epi16(full, a)));
+			res[half] = _mm_srli_epi16(sum, 8);
+		}
+		return _mm_or_si128(_mm_packus_epi16(res[0], res[1]), _mm_set1_epi32((int)0xFF000000));
+	}
+#endif
+
+	//Nearest texel at each pixel center inside the quad, as an unfiltered decal is drawn
+	void Draw(const quad& q, const Sprite* spr, Sprite* target)
+	{
+		int px0 = max(0, (int)ceil(min(q.x0, q.x1) - 0.5f)), px1 = min(target->width, (int)ceil(max(q.x0, q.x1) - 0.5f));
+		int py0 = max(0, (int)ceil(min(q.y0, q.y1) - 0.5f)), py1 = min(target->height, (int)ceil(max(q.y0, q.y1) - 0.5f));
+		if (px0 >= px1 || py0 >= py1)
+		{
+			return;
+		}
+
+		//Every row reads from the same columns, so work those out once
+		float du = (q.u1 - q.u0) / (q.x1 - q.x0), dv = (q.v1 - q.v0) / (q.y1 - q.y0);
+		cols.resize(px1 - px0);
+		for (int x = px0; x < px1; x++)
+		{
+			cols[x - px0] = max(0, min(spr->width - 1, (int)floor(q.u0 + (x + 0.5f - q.x0) * du)));
+		}
+
+		const Pixel* tex = spr->pColData.data();
+		Pixel* out = target->GetData();
+
+#ifdef CV_SSE2
+		Pixel t = q.tint;
+		const __m128i tint16 = _mm_set_epi16(t.a + (t.a >> 7), t.b + (t.b >> 7), t.g + (t.g >> 7), t.r + (t.r >> 7),
+											 t.a + (t.a >> 7), t.b + (t.b >> 7), t.g + (t.g >> 7), t.r + (t.r >> 7));
+#endif
+		for (int y = py0; y < py1; y++)
+		{
+			int ty = max(0, min(spr->height - 1, (int)floor(q.v0 + (y + 0.5f - q.y0) * dv)));
+			const Pixel* row = tex + ty * spr->width;
+			Pixel* dst = out + y * target->width + px0;
+			const int* c = cols.data();
+			int n = px1 - px0, k = 0;
+
+#ifdef CV_SSE2
+			for (; k + 4 <= n; k += 4)
+			{
+				__m128i src = _mm_set_epi32(row[c[k + 3]].n, row[c[k + 2]].n, row[c[k + 1]].n, row[c[k]].n);
+				__m128i d = _mm_loadu_si128((const __m128i*)(dst + k));
+				_mm_storeu_si128((__m128i*)(dst + k), TintBlend4(src, d, tint16));
+			}
+#endif
+			for (; k < n; k++)
+			{
+				dst[k] = span::BlendAlpha(Tint(row[c[k]], q.tint), dst[k]);
+			}
+		}
+	}
+
+public:
+	float lastMs = 0.0f; //How long drawing took from one Composite() to the end of the next, that one included
+
+	//Same as PixelGameEngine::DrawPartialDecal(), without the decal: part of a sprite, scaled, tinted and blended straight into the target
+	void DrawPartialSprite(Sprite* target, const vf2d& pos, const Sprite* spr, const vf2d& sourcePos, const vf2d& sourceSize, const vf2d& scale = { 1.0f, 1.0f }, const Pixel& tint = WHITE)
+	{
+		auto start = chrono::high_resolution_clock::now();
+
+		quad q;
+		q.x0 = floor(pos.x); //Decals are put on whole pixels
+		q.y0 = floor(pos.y);
+		q.x1 = q.x0 + sourceSize.x * scale.x;
+		q.y1 = q.y0 + sourceSize.y * scale.y;
+		q.u0 = sourcePos.x;
+		q.v0 = sourcePos.y;
+		q.u1 = sourcePos.x + sourceSize.x;
+		q.v1 = sourcePos.y + sourceSize.y;
+		q.tint = tint;
+		Draw(q, spr, target);
+
+		ms += chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//Same as PixelGameEngine::DrawDecal(), without the decal
+	void DrawSprite(Sprite* target, const vf2d& pos, const Sprite* spr, const vf2d& scale = { 1.0f, 1.0f }, const Pixel& tint = WHITE)
+	{
+		DrawPartialSprite(target, pos, spr, { 0.0f, 0.0f }, vf2d((float)spr->width, (float)spr->height), scale, tint);
+	}
+
+	//Draws the decals queued on a layer into its sprite, in the order they were queued, and takes them off the queue
+	//Runs of decals from the same sprite are drawn together, so its size and pixels are only looked up once per run
+	void Composite(LayerDesc& layer)
+	{
+		auto start = chrono::high_resolution_clock::now();
+
+		Sprite* target = layer.pDrawTarget;
+		vector<DecalInstance>& decals = layer.vecDecalInstance;
+		vector<DecalInstance> left;
+		int screenW = target->width, screenH = target->height;
+
+		for (size_t i = 0; i < decals.size();)
+		{
+			Decal* batch = decals[i].decal;
+			const Sprite* spr = batch != nullptr ? batch->sprite : nullptr;
+			for (; i < decals.size() && decals[i].decal == batch; i++)
+			{
+				quad q;
+				if (ToQuad(decals[i], screenW, screenH, q))
+				{
+					Draw(q, spr, target);
+				}
+				else
+				{
+					left.push_back(move(decals[i]));
+				}
+			}
+		}
+		decals = move(left);
+
+		lastMs = ms + chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+		ms = 0.0f;
+	}
+};
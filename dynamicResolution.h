@@ -0,0 +1,101 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include "workerPool.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace olc;
+
+//Picks the resolution the 3D pass is drawn at, as a fraction of the screen's, so the pass stays within a time budget
+//Its cost goes with the number of pixels, so the scale moves by the square root of how far over or under budget it is
+class DynamicResolution
+{
+private:
+	float scale = 1.0f;
+	float avgMs = -1.0f; //Smoothed pass time, so a single slow frame doesn't change the resolution
+
+public:
+	float budgetMs = 12.0f;
+	float minScale = 0.5f;
+	const float step = 1.0f / 16.0f; //Scales are kept to whole steps, so small changes in timing don't resize the buffers
+
+	float Scale() const
+	{
+		return scale;
+	}
+
+	//Takes the time the last pass took at the current scale. Returns true if the scale has changed
+	bool Update(float passMs)
+	{
+		//Starts off assumed on budget. One-off spikes (like the shadow map being redrawn) are capped, so they only nudge it
+		if (avgMs < 0.0f)
+		{
+			avgMs = 0.875f * budgetMs;
+		}
+		avgMs += 0.1f * (min(passMs, 2.0f * budgetMs) - avgMs);
+
+		//Anywhere between three quarters of the budget and the budget is left alone, so it doesn't flip between two sizes
+		if (avgMs <= budgetMs && avgMs >= 0.75f * budgetMs)
+		{
+			return false;
+		}
+
+		float target = scale * sqrtf(0.875f * budgetMs / avgMs);
+		target = max(minScale, min(1.0f, floor(target / step) * step));
+		if (target == scale)
+		{
+			return false;
+		}
+
+		//Expect the new size to cost in proportion to its pixels, until it has been timed
+		avgMs *= (target * target) / (scale * scale);
+		scale = target;
+		return true;
+	}
+};
+
+//Bilinear upscale of a whole image into a larger one, in 8.8 fixed point
+//Samples are taken at pixel centers, and clamped at the edges
+inline void UpscaleBilinear(const Pixel* src, int srcW, int srcH, Pixel* dst, int dstW, int dstH, WorkerPool& pool)
+{
+	//Every row reads from the same columns, so work those out once
+	struct tap { int x0, x1, f; };
+	vector<tap> cols(dstW);
+	for (int x = 0; x < dstW; x++)
+	{
+		float sx = max(0.0f, min(srcW - 1.0f, (x + 0.5f) * srcW / dstW - 0.5f));
+		int fx = (int)(sx * 256.0f);
+		cols[x] = { fx >> 8, min(srcW - 1, (fx >> 8) + 1), fx & 0xFF };
+	}
+
+	//Two channels at a time, as in sampler::Sample()
+	auto lerp2 = [](uint32_t a, uint32_t b, uint32_t f)
+	{
+		return ((a * (256 - f) + b * f) >> 8) & 0x00FF00FF;
+	};
+
+	pool.ParallelFor(dstH, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; y++)
+		{
+			float sy = max(0.0f, min(srcH - 1.0f, (y + 0.5f) * srcH / dstH - 0.5f));
+			int fy = (int)(sy * 256.0f);
+			const Pixel* top = src + (fy >> 8) * srcW;
+			const Pixel* bottom = src + min(srcH - 1, (fy >> 8) + 1) * srcW;
+			fy &= 0xFF;
+
+			Pixel* out = dst + y * dstW;
+			for (int x = 0; x < dstW; x++)
+			{
+				const tap& t = cols[x];
+				uint32_t p00 = top[t.x0].n, p10 = top[t.x1].n, p01 = bottom[t.x0].n, p11 = bottom[t.x1].n;
+
+				uint32_t rb = lerp2(lerp2(p00 & 0x00FF00FF, p10 & 0x00FF00FF, t.f), lerp2(p01 & 0x00FF00FF, p11 & 0x00FF00FF, t.f), fy);
+				uint32_t ga = lerp2(lerp2((p00 >> 8) & 0x00FF00FF, (p10 >> 8) & 0x00FF00FF, t.f), lerp2((p01 >> 8) & 0x00FF00FF, (p11 >> 8) & 0x00FF00FF, t.f), fy);
+				out[x].n = rb | (ga << 8);
+			}
+		}
+	}, 16);
+}
@@ -0,0 +1,654 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+
+using namespace std;
+using namespace olc;
+
+//Minimal OpenEXR reader, enough to bring rendered image sequences (e.g. the Ocean foam maps) into the engine
+//Supports single-part scanline images with NO, RLE, ZIPS and ZIP compression, and HALF/FLOAT/UINT channels
+//[https://openexr.com/en/latest/OpenEXRFileLayout.html]
+namespace exr
+{
+	#pragma region Inflate
+	//Just enough of a zlib/deflate decoder to unpack ZIP compressed EXR chunks
+	//[https://www.rfc-editor.org/rfc/rfc1951]
+
+	static const int fastBits = 9;
+
+	struct huffmanTable
+	{
+		uint16_t counts[16];		//Number of codes of each bit length
+		uint16_t symbols[288];		//Symbols, ordered by code
+		uint16_t fast[1 << fastBits];	//(length << 9) | symbol, for codes short enough to be looked up directly; 0 otherwise
+	};
+
+	struct bitReader
+	{
+		const uint8_t* data;
+		size_t size;
+		size_t pos = 0;
+		uint64_t buf = 0;
+		int count = 0;
+		bool overrun = false;
+
+		bitReader(const uint8_t* data, size_t size)
+			: data(data), size(size)
+		{}
+
+		void Refill()
+		{
+			while (count <= 56)
+			{
+				if (pos < size)
+				{
+					buf |= (uint64_t)data[pos] << count;
+				}
+				else if (pos > size + 8) //Reading well beyond the end of the stream
+				{
+					overrun = true;
+				}
+				pos++;
+				count += 8;
+			}
+		}
+
+		uint32_t Bits(int n)
+		{
+			if (n == 0) return 0;
+			if (count < n) Refill();
+			uint32_t res = (uint32_t)(buf & ((1ull << n) - 1));
+			buf >>= n;
+			count -= n;
+			return res;
+		}
+
+		//Discards any bits left over in the current byte
+		void AlignToByte()
+		{
+			Bits(count % 8);
+		}
+	};
+
+	static void BuildHuffmanTable(huffmanTable& t, const uint8_t* lengths, int n)
+	{
+		memset(t.counts, 0, sizeof(t.counts));
+		memset(t.fast, 0, sizeof(t.fast));
+
+		for (int i = 0; i < n; i++)
+		{
+			t.counts[lengths[i]]++;
+		}
+		t.counts[0] = 0;
+
+		uint16_t offsets[16];
+		uint16_t nextCode[16];
+		offsets[1] = 0;
+		nextCode[1] = 0;
+		for (int len = 1; len < 15; len++)
+		{
+			offsets[len + 1] = offsets[len] + t.counts[len];
+			nextCode[len + 1] = (nextCode[len] + t.counts[len]) << 1;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			int len = lengths[i];
+			if (len == 0) continue;
+
+			t.symbols[offsets[len]++] = i;
+
+			//Codes are stored most significant bit first, so reverse them for the lookup table
+			uint32_t code = nextCode[len]++;
+			if (len <= fastBits)
+			{
+				uint32_t rev = 0;
+				for (int b = 0; b < len; b++)
+				{
+					rev |= ((code >> b) & 1) << (len - 1 - b);
+				}
+				for (; rev < (1u << fastBits); rev += 1u << len)
+				{
+					t.fast[rev] = (uint16_t)((len << 9) | i);
+				}
+			}
+		}
+	}
+
+	static int DecodeSymbol(bitReader& br, const huffmanTable& t)
+	{
+		if (br.count < 16) br.Refill();
+
+		uint16_t e = t.fast[br.buf & ((1 << fastBits) - 1)];
+		if (e)
+		{
+			br.Bits(e >> 9);
+			return e & 0x1FF;
+		}
+
+		//Canonical decode, one bit at a time
+		int code = 0, first = 0, index = 0;
+		for (int len = 1; len < 16; len++)
+		{
+			code |= (int)((br.buf >> (len - 1)) & 1);
+			int count = t.counts[len];
+			if (code - first < count)
+			{
+				br.Bits(len);
+				return t.symbols[index + (code - first)];
+			}
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+
+	//Decompresses a zlib stream into out; returns false if the data is corrupt or does not fit
+	static bool Inflate(const uint8_t* src, size_t srcSize, uint8_t* out, size_t outSize, size_t& outWritten)
+	{
+		static const uint16_t lenBase[]   = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t  lenExtra[]  = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const uint16_t distBase[]  = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const uint8_t  distExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		static const uint8_t  clOrder[]   = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+		outWritten = 0;
+		if (srcSize < 2 || (src[0] & 0x0F) != 8) //Not a deflate stream
+		{
+			return false;
+		}
+
+		bitReader br(src + 2, srcSize - 2);
+		huffmanTable litTable, distTable;
+		size_t o = 0;
+		bool lastBlock = false;
+
+		while (!lastBlock)
+		{
+			lastBlock = br.Bits(1);
+			int type = br.Bits(2);
+
+			if (type == 0) //Stored
+			{
+				br.AlignToByte();
+				uint32_t len = br.Bits(16);
+				uint32_t nlen = br.Bits(16);
+				if ((len ^ 0xFFFF) != nlen || o + len > outSize) return false;
+				for (uint32_t i = 0; i < len; i++)
+				{
+					out[o++] = (uint8_t)br.Bits(8);
+				}
+			}
+			else if (type == 1 || type == 2) //Huffman compressed
+			{
+				uint8_t lengths[320];
+				if (type == 1) //Fixed codes
+				{
+					int i = 0;
+					for (; i < 144; i++) lengths[i] = 8;
+					for (; i < 256; i++) lengths[i] = 9;
+					for (; i < 280; i++) lengths[i] = 7;
+					for (; i < 288; i++) lengths[i] = 8;
+					BuildHuffmanTable(litTable, lengths, 288);
+					for (i = 0; i < 30; i++) lengths[i] = 5;
+					BuildHuffmanTable(distTable, lengths, 30);
+				}
+				else //Dynamic codes
+				{
+					int numLit = br.Bits(5) + 257;
+					int numDist = br.Bits(5) + 1;
+					int numCl = br.Bits(4) + 4;
+
+					uint8_t clLengths[19] = { 0 };
+					for (int i = 0; i < numCl; i++)
+					{
+						clLengths[clOrder[i]] = (uint8_t)br.Bits(3);
+					}
+					huffmanTable clTable;
+					BuildHuffmanTable(clTable, clLengths, 19);
+
+					int n = 0;
+					while (n < numLit + numDist)
+					{
+						int sym = DecodeSymbol(br, clTable);
+						if (sym < 0) return false;
+
+						if (sym < 16)
+						{
+							lengths[n++] = (uint8_t)sym;
+							continue;
+						}
+
+						int repeat = 0;
+						uint8_t val = 0;
+						if (sym == 16)
+						{
+							if (n == 0) return false;
+							val = lengths[n - 1];
+							repeat = 3 + br.Bits(2);
+						}
+						else if (sym == 17) { repeat = 3 + br.Bits(3); }
+						else				{ repeat = 11 + br.Bits(7); }
+
+						if (n + repeat > numLit + numDist) return false;
+						while (repeat--) lengths[n++] = val;
+					}
+
+					BuildHuffmanTable(litTable, lengths, numLit);
+					BuildHuffmanTable(distTable, lengths + numLit, numDist);
+				}
+
+				while (true)
+				{
+					int sym = DecodeSymbol(br, litTable);
+					if (sym < 0) return false;
+
+					if (sym < 256) //Literal
+					{
+						if (o >= outSize) return false;
+						out[o++] = (uint8_t)sym;
+					}
+					else if (sym == 256) //End of block
+					{
+						break;
+					}
+					else //Back-reference
+					{
+						sym -= 257;
+						if (sym >= 29) return false;
+						size_t len = lenBase[sym] + br.Bits(lenExtra[sym]);
+
+						int dsym = DecodeSymbol(br, distTable);
+						if (dsym < 0 || dsym >= 30) return false;
+						size_t dist = distBase[dsym] + br.Bits(distExtra[dsym]);
+
+						if (dist > o || o + len > outSize) return false;
+						for (size_t i = 0; i < len; i++, o++)
+						{
+							out[o] = out[o - dist];
+						}
+					}
+				}
+			}
+			else
+			{
+				return false;
+			}
+
+			if (br.overrun) return false;
+		}
+
+		outWritten = o;
+		return true;
+	}
+	#pragma endregion
+
+	#pragma region Pixel Conversion
+	static float HalfToFloat(uint16_t h)
+	{
+		uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+		uint32_t exponent = (h >> 10) & 0x1F;
+		uint32_t mantissa = h & 0x3FF;
+		uint32_t bits;
+
+		if (exponent == 0)
+		{
+			if (mantissa == 0) //Zero
+			{
+				bits = sign;
+			}
+			else //Denormal, renormalise it
+			{
+				exponent = 127 - 15 + 1;
+				while (!(mantissa & 0x400))
+				{
+					mantissa <<= 1;
+					exponent--;
+				}
+				mantissa &= 0x3FF;
+				bits = sign | (exponent << 23) | (mantissa << 13);
+			}
+		}
+		else if (exponent == 31) //Inf/NaN
+		{
+			bits = sign | 0x7F800000 | (mantissa << 13);
+		}
+		else
+		{
+			bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+		}
+
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	//Maps a linear colour value to an 8-bit sRGB value, clamping anything brighter than white
+	static uint8_t ToneMapColour(float v)
+	{
+		if (!(v > 0.0f)) return 0; //Also catches NaN
+		if (v >= 1.0f) return 255;
+		float s = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+		return (uint8_t)(s * 255.0f + 0.5f);
+	}
+
+	static uint8_t ToneMapAlpha(float v)
+	{
+		if (!(v > 0.0f)) return 0;
+		if (v >= 1.0f) return 255;
+		return (uint8_t)(v * 255.0f + 0.5f);
+	}
+
+	//Every half value maps to a fixed 8-bit result, so tone mapping HALF channels is a single table lookup
+	struct halfLookup
+	{
+		uint8_t colour[65536];
+		uint8_t alpha[65536];
+
+		halfLookup()
+		{
+			for (uint32_t h = 0; h < 65536; h++)
+			{
+				float f = HalfToFloat((uint16_t)h);
+				colour[h] = ToneMapColour(f);
+				alpha[h] = ToneMapAlpha(f);
+			}
+		}
+	};
+
+	static const halfLookup& GetHalfLookup()
+	{
+		static const halfLookup lut; //Thread-safe initialisation, sequences are decoded off the main thread
+		return lut;
+	}
+	#pragma endregion
+
+	enum compression { NO_COMPRESSION = 0, RLE = 1, ZIPS = 2, ZIP = 3 };
+	enum pixelType { UINT = 0, HALF = 1, FLOAT = 2 };
+
+	struct channel
+	{
+		string name;
+		int type;
+		int target; //0-3 = RGBA, -1 = ignored
+	};
+
+	static uint32_t ReadU32(const uint8_t* p)
+	{
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	static uint64_t ReadU64(const uint8_t* p)
+	{
+		return (uint64_t)ReadU32(p) | ((uint64_t)ReadU32(p + 4) << 32);
+	}
+
+	static float ReadF32(const uint8_t* p)
+	{
+		uint32_t bits = ReadU32(p);
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	//Undoes the byte predictor and byte-plane split that ZIP and RLE compression apply before compressing
+	static void Reconstruct(const uint8_t* in, uint8_t* out, size_t size)
+	{
+		vector<uint8_t> tmp(in, in + size);
+		for (size_t i = 1; i < size; i++)
+		{
+			tmp[i] = (uint8_t)(tmp[i - 1] + tmp[i] - 128);
+		}
+
+		const uint8_t* t1 = tmp.data();
+		const uint8_t* t2 = tmp.data() + (size + 1) / 2;
+		for (size_t i = 0; i < size; i++)
+		{
+			out[i] = (i & 1) ? *t2++ : *t1++;
+		}
+	}
+
+	static bool DecompressRLE(const uint8_t* src, size_t srcSize, uint8_t* out, size_t outSize, size_t& outWritten)
+	{
+		size_t i = 0, o = 0;
+		while (i < srcSize)
+		{
+			int count = (int8_t)src[i++];
+			if (count < 0) //Literal run
+			{
+				count = -count;
+				if (i + count > srcSize || o + count > outSize) return false;
+				memcpy(out + o, src + i, count);
+				i += count;
+				o += count;
+			}
+			else //Repeated byte
+			{
+				if (i >= srcSize || o + count + 1 > outSize) return false;
+				memset(out + o, src[i++], count + 1);
+				o += count + 1;
+			}
+		}
+		outWritten = o;
+		return true;
+	}
+
+	//Loads a scanline .exr file into a new sprite, tone mapped to 8 bits per channel
+	//Returns nullptr (and prints why) if the file cannot be read
+	static Sprite* LoadSprite(const string& fileName)
+	{
+		ifstream f(fileName, ios::binary);
+		if (!f.is_open())
+		{
+			cout << "Could not open " << fileName << endl;
+			return nullptr;
+		}
+		vector<uint8_t> file((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+		f.close();
+
+		auto fail = [&](const char* reason) -> Sprite*
+		{
+			cout << fileName << ": " << reason << endl;
+			return nullptr;
+		};
+
+		if (file.size() < 8 || ReadU32(file.data()) != 20000630)
+		{
+			return fail("not an OpenEXR file");
+		}
+		uint32_t version = ReadU32(file.data() + 4);
+		if (version & 0x1A00) //Tiled, deep or multi-part
+		{
+			return fail("only single-part scanline images are supported");
+		}
+
+		//===== HEADER =====
+		vector<channel> channels;
+		int comp = -1;
+		int xMin = 0, yMin = 0, xMax = -1, yMax = -1;
+		size_t p = 8;
+
+		auto readString = [&](string& s) -> bool
+		{
+			size_t end = p;
+			while (end < file.size() && file[end] != 0) end++;
+			if (end >= file.size()) return false;
+			s.assign((const char*)&file[p], end - p);
+			p = end + 1;
+			return true;
+		};
+
+		while (true)
+		{
+			string name, type;
+			if (!readString(name)) return fail("truncated header");
+			if (name.empty()) break; //End of header
+
+			if (!readString(type) || p + 4 > file.size()) return fail("truncated header");
+			uint32_t size = ReadU32(&file[p]);
+			p += 4;
+			if (p + size > file.size()) return fail("truncated header");
+			const uint8_t* val = &file[p];
+
+			if (name == "channels")
+			{
+				size_t c = 0;
+				while (c < size && val[c] != 0)
+				{
+					channel ch;
+					while (c < size && val[c] != 0) ch.name += (char)val[c++];
+					c++;
+					if (c + 16 > size) return fail("bad channel list");
+					ch.type = (int)ReadU32(val + c);
+					c += 16; //type, pLinear + reserved, xSampling, ySampling
+
+					//Layered names such as "foam.R" only care about the last component
+					string base = ch.name.substr(ch.name.find_last_of('.') + 1);
+					ch.target = base == "R" ? 0 : base == "G" ? 1 : base == "B" ? 2 : base == "A" ? 3 : base == "Y" ? 0 : -1;
+					channels.push_back(ch);
+				}
+			}
+			else if (name == "compression")
+			{
+				comp = val[0];
+			}
+			else if (name == "dataWindow")
+			{
+				xMin = (int)ReadU32(val);
+				yMin = (int)ReadU32(val + 4);
+				xMax = (int)ReadU32(val + 8);
+				yMax = (int)ReadU32(val + 12);
+			}
+
+			p += size;
+		}
+
+		int width = xMax - xMin + 1;
+		int height = yMax - yMin + 1;
+		if (width <= 0 || height <= 0 || channels.empty())
+		{
+			return fail("missing data window or channels");
+		}
+
+		int linesPerChunk;
+		switch (comp)
+		{
+			case NO_COMPRESSION:
+			case RLE:
+			case ZIPS:
+				linesPerChunk = 1;
+				break;
+			case ZIP:
+				linesPerChunk = 16;
+				break;
+			default:
+				return fail("unsupported compression (use NONE, RLE, ZIPS or ZIP)");
+		}
+
+		bool greyscale = true;
+		size_t bytesPerPixel = 0;
+		for (channel& ch : channels)
+		{
+			bytesPerPixel += ch.type == HALF ? 2 : 4;
+			if (ch.target == 1 || ch.target == 2) greyscale = false;
+		}
+
+		//===== PIXEL DATA =====
+		int numChunks = (height + linesPerChunk - 1) / linesPerChunk;
+		if (p + numChunks * 8 > file.size()) return fail("truncated offset table");
+
+		const halfLookup& lut = GetHalfLookup();
+		Sprite* spr = new Sprite(width, height);
+		Pixel* dst = spr->GetData();
+
+		vector<uint8_t> unpacked(bytesPerPixel * width * linesPerChunk);
+		vector<uint8_t> scratch(unpacked.size());
+
+		for (int c = 0; c < numChunks; c++)
+		{
+			size_t offset = (size_t)ReadU64(&file[p + c * 8]);
+			if (offset + 8 > file.size())
+			{
+				delete spr;
+				return fail("bad chunk offset");
+			}
+
+			int y = (int)ReadU32(&file[offset]) - yMin;
+			uint32_t dataSize = ReadU32(&file[offset + 4]);
+			const uint8_t* data = &file[offset + 8];
+			if (offset + 8 + dataSize > file.size() || y < 0 || y >= height)
+			{
+				delete spr;
+				return fail("bad chunk");
+			}
+
+			int lines = min(linesPerChunk, height - y);
+			size_t expected = bytesPerPixel * width * lines;
+			const uint8_t* pixels = data;
+
+			if (dataSize < expected) //Compressed chunk; chunks that would not shrink are stored raw
+			{
+				size_t written = 0;
+				bool ok = comp == RLE ? DecompressRLE(data, dataSize, scratch.data(), expected, written)
+									  : Inflate(data, dataSize, scratch.data(), expected, written);
+				if (!ok || written != expected)
+				{
+					delete spr;
+					return fail("corrupt chunk data");
+				}
+				Reconstruct(scratch.data(), unpacked.data(), expected);
+				pixels = unpacked.data();
+			}
+
+			//Each line stores every channel's row one after the other, channels in alphabetical order
+			for (int l = 0; l < lines; l++)
+			{
+				Pixel* row = dst + (size_t)(y + l) * width;
+				for (int x = 0; x < width; x++)
+				{
+					row[x] = Pixel(0, 0, 0, 255);
+				}
+
+				for (channel& ch : channels)
+				{
+					int size = ch.type == HALF ? 2 : 4;
+					if (ch.target != -1)
+					{
+						for (int x = 0; x < width; x++)
+						{
+							const uint8_t* v = pixels + x * size;
+							uint8_t b;
+							if (ch.type == HALF)
+							{
+								uint16_t h = (uint16_t)(v[0] | (v[1] << 8));
+								b = ch.target == 3 ? lut.alpha[h] : lut.colour[h];
+							}
+							else
+							{
+								float fv = ch.type == FLOAT ? ReadF32(v) : (float)ReadU32(v) / 4294967295.0f;
+								b = ch.target == 3 ? ToneMapAlpha(fv) : ToneMapColour(fv);
+							}
+
+							if (greyscale && ch.target == 0)
+							{
+								row[x].r = row[x].g = row[x].b = b;
+							}
+							else
+							{
+								((uint8_t*)&row[x])[ch.target] = b; //r, g, b, a are laid out in order
+							}
+						}
+					}
+					pixels += size * width;
+				}
+			}
+		}
+
+		return spr;
+	}
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+#ifdef __linux__
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#else
+	#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+//Hash of everything in a file, to tell whether it really changed. 0 if it can't be read
+static size_t HashFileContents(const string& fileName)
+{
+	ifstream f(fileName, ios::binary);
+	if (!f.is_open())
+	{
+		return 0;
+	}
+	string contents((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+	return hash<string>()(contents);
+}
+
+//Tells which of a set of files have been written to since it was last asked
+//On Linux, inotify reports writes as they happen, watching each file's folder so files that editors save by replacing them are seen too
+//Elsewhere the files' modification times are checked instead, a couple of times a second
+class FileWatcher
+{
+private:
+	struct watched
+	{
+		string path; //As it was given
+		string folder, name;
+#ifdef __linux__
+		int wd = -1;
+#else
+		time_t modified = 0;
+#endif
+	};
+
+	vector<watched> files;
+
+#ifdef __linux__
+	int fd = -1;
+#else
+	const float pollSeconds = 0.5f;
+	chrono::steady_clock::time_point lastPoll;
+
+	static time_t Modified(const string& fileName)
+	{
+		struct stat st;
+		return stat(fileName.c_str(), &st) == 0 ? st.st_mtime : 0;
+	}
+#endif
+
+	void Close()
+	{
+#ifdef __linux__
+		if (fd != -1)
+		{
+			close(fd);
+			fd = -1;
+		}
+#endif
+		files.clear();
+	}
+
+public:
+	~FileWatcher()
+	{
+		Close();
+	}
+
+	//Starts watching these files, in place of any watched before. They don't have to exist yet
+	void Watch(const vector<string>& fileNames)
+	{
+		Close();
+
+#ifdef __linux__
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+		for (const string& fn : fileNames)
+		{
+			watched w;
+			w.path = fn;
+			size_t slash = fn.find_last_of("/\\");
+			w.folder = slash == string::npos ? "." : fn.substr(0, slash);
+			w.name = slash == string::npos ? fn : fn.substr(slash + 1);
+#ifdef __linux__
+			//Adding the same folder again gives back the same watch
+			w.wd = fd == -1 ? -1 : inotify_add_watch(fd, w.folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+#else
+			w.modified = Modified(fn);
+#endif
+			files.push_back(w);
+		}
+#ifndef __linux__
+		lastPoll = chrono::steady_clock::now();
+#endif
+	}
+
+	//Files written to since the last call, each only once
+	vector<string> Changed()
+	{
+		vector<string> changed;
+		auto add = [&](const string& fn)
+		{
+			if (find(changed.begin(), changed.end(), fn) == changed.end())
+			{
+				changed.push_back(fn);
+			}
+		};
+
+#ifdef __linux__
+		if (fd == -1)
+		{
+			return changed;
+		}
+
+		alignas(inotify_event) char buffer[4096];
+		ssize_t len;
+		while ((len = read(fd, buffer, sizeof(buffer))) > 0)
+		{
+			for (char* p = buffer; p < buffer + len; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+			{
+				const inotify_event* ev = (const inotify_event*)p;
+				if (ev->len == 0)
+				{
+					continue;
+				}
+				for (const watched& w : files)
+				{
+					if (w.wd == ev->wd && w.name == ev->name)
+					{
+						add(w.path);
+					}
+				}
+			}
+		}
+#else
+		auto now = chrono::steady_clock::now();
+		if (chrono::duration<float>(now - lastPoll).count() < pollSeconds)
+		{
+			return changed;
+		}
+		lastPoll = now;
+
+		for (watched& w : files)
+		{
+			time_t modified = Modified(w.path);
+			if (modified != w.modified)
+			{
+				w.modified = modified;
+				add(w.path);
+			}
+		}
+#endif
+		return changed;
+	}
+};
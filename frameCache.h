@@ -0,0 +1,87 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include "types3d.h"
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+using namespace std;
+using namespace olc;
+
+//Area of the screen in pixels, inclusive. Starts off empty
+struct screenRect
+{
+	int x0 = INT_MAX, y0 = INT_MAX;
+	int x1 = INT_MIN, y1 = INT_MIN;
+
+	screenRect() {}
+	screenRect(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+	bool empty() const
+	{
+		return x1 < x0 || y1 < y0;
+	}
+
+	//Grows to cover a point, rounding outwards
+	void add(float x, float y)
+	{
+		x0 = min(x0, (int)floor(x));
+		y0 = min(y0, (int)floor(y));
+		x1 = max(x1, (int)ceil(x));
+		y1 = max(y1, (int)ceil(y));
+	}
+
+	void add(const screenRect& r)
+	{
+		if (r.empty())
+		{
+			return;
+		}
+		x0 = min(x0, r.x0);
+		y0 = min(y0, r.y0);
+		x1 = max(x1, r.x1);
+		y1 = max(y1, r.y1);
+	}
+
+	bool overlaps(const screenRect& r) const
+	{
+		return !empty() && !r.empty() && x0 <= r.x1 && r.x0 <= x1 && y0 <= r.y1 && r.y0 <= y1;
+	}
+
+	//Grown by a margin on every side, then cut down to fit a w*h screen
+	screenRect padded(int margin, int w, int h) const
+	{
+		if (empty())
+		{
+			return *this;
+		}
+		return screenRect(max(0, x0 - margin), max(0, y0 - margin), min(w - 1, x1 + margin), min(h - 1, y1 + margin));
+	}
+};
+
+//The last frame's 3D pass, kept while the view holds still, so following frames only redraw the areas that have changed
+//Everything here is at the render resolution
+struct frameCache
+{
+	bool valid = false;
+	vector<float> viewKey; //Everything the picture depends on besides what is in the scene; see Engine3D::ViewKey()
+
+	vector<Pixel> preBloom;  //Colour before bloom is added, for redrawing areas into
+	vector<Pixel> postBloom; //The finished 3D pass, for frames where nothing has changed at all
+
+	vector<triangle> staticTris;		//Projected triangles of every mesh that doesn't move
+	vector<screenRect> materialRects;	//Per material, where its static triangles are, for when it animates
+	screenRect prevDynamic;				//Where the moving meshes were drawn last frame
+
+	//Returns true if the view is the same as it was last time this was called
+	bool SameView(const vector<float>& key)
+	{
+		bool same = key == viewKey;
+		if (!same)
+		{
+			viewKey = key;
+			valid = false;
+		}
+		return same;
+	}
+};
@@ -0,0 +1,200 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include "types3d.h"
+#include "exr.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+using namespace olc;
+
+//Streams an animated texture from a numbered sequence of image files, e.g. Ocean\\Foam\\foam_####.exr
+//Only a small ring of decoded frames is kept in memory; the frames coming up next are decoded
+//(and tone mapped, and mipped) on a background thread while the current one is being drawn
+class ImageSequence
+{
+private:
+	struct slot
+	{
+		int frame = -1; //-1 = empty
+		bool ready = false;
+		texture tex;
+	};
+
+	string pattern;
+	int startFrame, numFrames;
+	float fps;
+
+	vector<slot> ring;
+	int currSlot = 0;
+	int displayFrame = 0; //Frame the renderer wants to show, relative to startFrame
+
+	thread worker;
+	mutex m;
+	condition_variable cv;
+	bool quit = false;
+
+	//Replaces the run of '#' characters in the pattern with the zero-padded frame number
+	string FrameFileName(int frame) const
+	{
+		size_t first = pattern.find('#');
+		if (first == string::npos)
+		{
+			return pattern;
+		}
+		size_t last = pattern.find_first_not_of('#', first);
+		size_t width = (last == string::npos ? pattern.size() : last) - first;
+
+		string num = to_string(startFrame + frame);
+		if (num.size() < width)
+		{
+			num.insert(0, width - num.size(), '0');
+		}
+
+		return pattern.substr(0, first) + num + pattern.substr(first + width);
+	}
+
+	//.exr frames go through the EXR reader; anything else (e.g. a sequence pre-converted to .png/.jpg) through the PGE loader
+	texture LoadFrame(int frame) const
+	{
+		string fileName = FrameFileName(frame);
+		Sprite* spr = nullptr;
+
+		string ext = fileName.substr(fileName.find_last_of('.') + 1);
+		for (char& c : ext) c = tolower(c);
+
+		if (ext == "exr")
+		{
+			spr = exr::LoadSprite(fileName);
+		}
+		else
+		{
+			spr = new Sprite(fileName);
+		}
+
+		if (spr == nullptr || spr->width == 0)
+		{
+			delete spr;
+			spr = new Sprite(1, 1); //Keep the animation going with a placeholder
+		}
+
+		return texture(spr);
+	}
+
+	//Distance from the displayed frame to the given one, going forwards and wrapping around the end of the sequence
+	int FramesAhead(int frame) const
+	{
+		return (frame - displayFrame + numFrames) % numFrames;
+	}
+
+	void DecodeLoop()
+	{
+		unique_lock<mutex> lock(m);
+
+		while (!quit)
+		{
+			//Find the nearest upcoming frame that is not already in (or on its way into) the ring
+			int frameToLoad = -1;
+			int lookAhead = min((int)ring.size(), numFrames);
+			for (int d = 0; d < lookAhead && frameToLoad == -1; d++)
+			{
+				int frame = (displayFrame + d) % numFrames;
+				bool inRing = false;
+				for (slot& s : ring)
+				{
+					inRing |= s.frame == frame;
+				}
+				if (!inRing)
+				{
+					frameToLoad = frame;
+				}
+			}
+
+			//Reuse a slot holding a frame that has already been shown
+			int slotToUse = -1;
+			if (frameToLoad != -1)
+			{
+				for (int i = 0; i < (int)ring.size() && slotToUse == -1; i++)
+				{
+					if (i != currSlot && (ring[i].frame == -1 || FramesAhead(ring[i].frame) >= lookAhead))
+					{
+						slotToUse = i;
+					}
+				}
+			}
+
+			if (slotToUse == -1)
+			{
+				cv.wait(lock); //Ring is full of upcoming frames; wait for the renderer to move on
+				continue;
+			}
+
+			slot& s = ring[slotToUse];
+			s.tex = texture(); //Frees the frame it held
+			s.frame = frameToLoad;
+			s.ready = false;
+
+			lock.unlock();
+			texture tex = LoadFrame(frameToLoad);
+			lock.lock();
+
+			s.tex = tex;
+			s.ready = true;
+		}
+	}
+
+public:
+	//The first frame is decoded up front so there is always something to draw
+	ImageSequence(const string& pattern, int startFrame, int endFrame, float fps, int ringSize = 3)
+		: pattern(pattern), startFrame(startFrame), numFrames(max(1, endFrame - startFrame + 1)), fps(fps),
+		  ring(max(2, ringSize))
+	{
+		ring[0].frame = 0;
+		ring[0].tex = LoadFrame(0);
+		ring[0].ready = true;
+
+		worker = thread(&ImageSequence::DecodeLoop, this);
+	}
+
+	ImageSequence(const ImageSequence&) = delete;
+
+	~ImageSequence()
+	{
+		{
+			lock_guard<mutex> lock(m);
+			quit = true;
+		}
+		cv.notify_all();
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+	}
+
+	//Picks the frame for the given time. If the decoder has fallen behind, the last decoded frame stays up
+	//and the decoder skips ahead to the wanted frame rather than playing out the backlog
+	void Advance(float time)
+	{
+		{
+			lock_guard<mutex> lock(m);
+
+			displayFrame = (int)floor(time * fps) % numFrames;
+
+			for (int i = 0; i < (int)ring.size(); i++)
+			{
+				if (ring[i].ready && ring[i].frame == displayFrame)
+				{
+					currSlot = i;
+				}
+			}
+		}
+		cv.notify_one();
+	}
+
+	//Only valid until the next call to Advance()
+	texture& Current()
+	{
+		return ring[currSlot].tex;
+	}
+};
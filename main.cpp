@@ -19,11 +19,24 @@ class Main : public PixelGameEngine
         int screenW, screenH;
         HCURSOR hCursor;
 
+        //Camera logs: F5 starts and stops recording one, F6 replays it
+        const string cameraLogFile = "camera.cvlog";
+        CameraRecorder recorder;
+        CameraReplay replay;
+        bool replaying = false;
+        bool quitAfterReplay = false;
+
     public:
-        Main()
+        Main(const string& replayFile = "")
         {
             sAppName = "Test";
             bShowFPS = true;
+
+            //Replaying from the command line quits once it's done, for running on a build server
+            if (!replayFile.empty())
+            {
+                replaying = quitAfterReplay = replay.Load(replayFile);
+            }
         }
     
     public:
@@ -44,6 +57,25 @@ class Main : public PixelGameEngine
         //titleScreen::Update(this);
         //sc.Update();
 
+        //A replay ignores input and runs at a fixed timestep, so every run draws the same frames
+        if (replaying)
+        {
+            const cameraFrame* frame = replay.Next();
+            if (frame != nullptr)
+            {
+                e3d.ReplayFrame(frame);
+                auto start = chrono::steady_clock::now();
+                e3d.Update(this, 1.0f / 60.0f);
+                replay.AddTiming(chrono::duration<float, milli>(chrono::steady_clock::now() - start).count());
+                return true;
+            }
+
+            replay.WriteTimings("camera_replay.csv");
+            replaying = false;
+            if (quitAfterReplay)
+                return false;
+        }
+
         mouseX = max(0, min(ScreenWidth(), GetMouseX()));
         mouseY = max(0, min(ScreenHeight(), GetMouseY()));
         
@@ -100,6 +132,17 @@ class Main : public PixelGameEngine
             e3d.NextPathPoint();
         if (GetKey(Key::F3).bPressed)
             e3d.ToggleDebugMode();
+        if (GetKey(Key::F4).bPressed)
+            e3d.ToggleSoftwareDecals();
+        if (GetKey(Key::F5).bPressed)
+        {
+            if (recorder.Recording())
+                recorder.Stop();
+            else
+                recorder.Start(cameraLogFile, e3d.PathCount());
+        }
+        if (GetKey(Key::F6).bPressed && !recorder.Recording())
+            replaying = replay.Load(cameraLogFile);
         if (GetKey(Key::R).bReleased)
             e3d.ResetPaths();
         if (GetKey(Key::L).bPressed)
@@ -119,6 +162,9 @@ class Main : public PixelGameEngine
 
         e3d.Update(this, fElapsedTime);
 
+        if (recorder.Recording())
+            recorder.Write(e3d.CaptureFrame(fElapsedTime));
+
         prevMouseX = mouseX;
         prevMouseY = mouseY;
 
@@ -127,9 +173,11 @@ class Main : public PixelGameEngine
 
 };
 
-int main()
+//main.exe --replay <camera log> draws the frames in the log, writes how long each took, then quits
+int main(int argc, char** argv)
 {
-    Main main;
+    string replayFile = argc > 2 && string(argv[1]) == "--replay" ? argv[2] : "";
+    Main main(replayFile);
 
     if(main.Construct(512, 512, 2, 2))
     {
@@ -7,6 +7,7 @@
 #include <memory>
 #include <unordered_map>
 #include "../olcPixelGameEngine.h"
+#include "olcPGEX_FontLayout.h"
 
 namespace olc
 {
@@ -33,8 +34,19 @@ namespace olc
 
         float                           fCharWidth;
         float                           fCharHeight;
+
+        // Glyphs below nDenseGlyphs (ASCII and Latin-1) are indexed directly; any others are looked up in the maps
+        static const uint32_t           nDenseGlyphs = 256;
+        std::vector<std::pair<olc::vi2d, olc::vi2d> > vGlyphPositionsMono;
+        std::vector<std::pair<olc::vi2d, olc::vi2d> > vGlyphPositionsProp;
         std::unordered_map<uint32_t, std::pair<olc::vi2d, olc::vi2d> > mGlyphPositionsMono;
         std::unordered_map<uint32_t, std::pair<olc::vi2d, olc::vi2d> > mGlyphPositionsProp;
+
+        const std::pair<olc::vi2d, olc::vi2d>& GlyphMono(uint32_t c) const;
+        const std::pair<olc::vi2d, olc::vi2d>& GlyphProp(uint32_t c) const;
+
+        olc::TextLayoutCache            layoutsProp;
+        void LayoutProp(olc::TextLayout& layout, const std::string& sText, const olc::vf2d& scale);
     };
 }
 
@@ -61,6 +73,10 @@ namespace olc
         fontSprite = std::make_unique<olc::Sprite>( sFontFile, pack );
         fontDecal = std::make_unique<olc::Decal>( fontSprite.get() );
 
+        // Glyphs missing from the font stay empty, so they take no space and draw nothing
+        vGlyphPositionsMono.resize( nDenseGlyphs );
+        vGlyphPositionsProp.resize( nDenseGlyphs );
+
         // Find the CFON signature and extract the embedded font information
         int dataRow = -1;
         for( auto i = fontSprite->height-1; dataRow<0 && i>-1; i-- )
@@ -88,8 +104,16 @@ namespace olc
                 uint32_t nGlyph     = fontSprite->GetPixel( pixelX+1, pixelY ).n;
                 int x               = i % nCharsPerRow * nCharWidth + nOffset;
                 int y               = i / nCharsPerRow * nCharHeight;
-                mGlyphPositionsMono.emplace( nGlyph, std::make_pair<olc::vi2d, olc::vi2d>( {x,y}, {nCharWidth,nCharHeight-1}) );
-                mGlyphPositionsProp.emplace( nGlyph, std::make_pair<olc::vi2d, olc::vi2d>( {x,y}, {nWidth, nCharHeight-1}) );
+                if( nGlyph < nDenseGlyphs )
+                {
+                    vGlyphPositionsMono[nGlyph] = std::make_pair<olc::vi2d, olc::vi2d>( {x,y}, {nCharWidth,nCharHeight-1});
+                    vGlyphPositionsProp[nGlyph] = std::make_pair<olc::vi2d, olc::vi2d>( {x,y}, {nWidth, nCharHeight-1});
+                }
+                else
+                {
+                    mGlyphPositionsMono.emplace( nGlyph, std::make_pair<olc::vi2d, olc::vi2d>( {x,y}, {nCharWidth,nCharHeight-1}) );
+                    mGlyphPositionsProp.emplace( nGlyph, std::make_pair<olc::vi2d, olc::vi2d>( {x,y}, {nWidth, nCharHeight-1}) );
+                }
             }
 
             fCharWidth = float(nCharWidth);
@@ -103,6 +127,24 @@ namespace olc
     }
 
 
+    const std::pair<olc::vi2d, olc::vi2d>& CustomFont::GlyphMono(uint32_t c) const
+    {
+        static const std::pair<olc::vi2d, olc::vi2d> empty;
+        if( c < nDenseGlyphs ) return vGlyphPositionsMono[c];
+        auto it = mGlyphPositionsMono.find( c );
+        return it != mGlyphPositionsMono.end() ? it->second : empty;
+    }
+
+
+    const std::pair<olc::vi2d, olc::vi2d>& CustomFont::GlyphProp(uint32_t c) const
+    {
+        static const std::pair<olc::vi2d, olc::vi2d> empty;
+        if( c < nDenseGlyphs ) return vGlyphPositionsProp[c];
+        auto it = mGlyphPositionsProp.find( c );
+        return it != mGlyphPositionsProp.end() ? it->second : empty;
+    }
+
+
     olc::vi2d CustomFont::GetTextSize(const std::string& s)
     {
         olc::vi2d size = { 0,1 };
@@ -119,21 +161,38 @@ namespace olc
     }
 
     
-    olc::vi2d CustomFont::GetTextSizeProp(const std::string& s)
+    void CustomFont::LayoutProp(olc::TextLayout& layout, const std::string& sText, const olc::vf2d& scale)
     {
         olc::vi2d size = { 0,1 };
         olc::vi2d pos = { 0,1 };
-        for( int i=0; i < (int)s.size(); )
+        olc::vf2d spos = { 0.0f, 0.0f };
+        for( int i=0; i < (int)sText.size(); )
         {
-            uint32_t c = _next_utf8_codepoint( s, i );
-            if (c == '\n') { pos.y += 1 ;  pos.x = 0; }
-            else pos.x += mGlyphPositionsProp[c].second.x;
+            uint32_t c = _next_utf8_codepoint( sText, i );
+            if (c == '\n')
+            {
+                pos.y += 1 ;  pos.x = 0;
+                spos.x = 0; spos.y += fCharHeight * scale.y;
+            }
+            else
+            {
+                auto& glyph = GlyphProp(c);
+                layout.vGlyphs.emplace_back(spos, &glyph);
+                pos.x += glyph.second.x;
+                spos.x += glyph.second.x * scale.x;
+            }
             size.x = std::max(size.x, pos.x);
             size.y = std::max(size.y, pos.y);
         }
 
         size.y *= (int)fCharHeight;
-        return size;
+        layout.size = size;
+    }
+
+
+    olc::vi2d CustomFont::GetTextSizeProp(const std::string& s)
+    {
+        return layoutsProp.Get(s, { 1.0f, 1.0f }, [&](olc::TextLayout& layout) { LayoutProp(layout, s, { 1.0f, 1.0f }); }).size;
     }
     
 
@@ -149,7 +208,7 @@ namespace olc
             }
             else
             {
-                auto& glyph = mGlyphPositionsMono[c];
+                auto& glyph = GlyphMono(c);
                 pge->DrawPartialDecal(pos + spos, fontDecal.get(), glyph.first, glyph.second, scale, col);
                 spos.x += fCharWidth * scale.x;
             }
@@ -169,7 +228,7 @@ namespace olc
             }
             else
             {
-                auto& glyph = mGlyphPositionsMono[c];
+                auto& glyph = GlyphMono(c);
                 pge->DrawPartialRotatedDecal(pos, fontDecal.get(), fAngle, spos, glyph.first, glyph.second, scale, col);
                 spos.x -= fCharWidth;
             }
@@ -179,21 +238,9 @@ namespace olc
 
     void CustomFont::DrawStringPropDecal(const olc::vf2d& pos, const std::string& sText, const Pixel col, const olc::vf2d& scale)
     {
-        olc::vf2d spos = { 0.0f, 0.0f };
-        for( int i=0; i < (int)sText.size(); )
-        {
-            uint32_t c = _next_utf8_codepoint( sText, i );
-            if (c == '\n')
-            {
-                spos.x = 0; spos.y += fCharHeight * scale.y;
-            }
-            else
-            {
-                auto& glyph = mGlyphPositionsProp[c];
-                pge->DrawPartialDecal(pos + spos, fontDecal.get(), glyph.first, glyph.second, scale, col);
-                spos.x += glyph.second.x * scale.x;
-            }
-        }
+        auto& layout = layoutsProp.Get(sText, scale, [&](olc::TextLayout& l) { LayoutProp(l, sText, scale); });
+        for( auto& g : layout.vGlyphs )
+            pge->DrawPartialDecal(pos + g.first, fontDecal.get(), g.second->first, g.second->second, scale, col);
     }
 
 
@@ -209,7 +256,7 @@ namespace olc
             }
             else
             {
-                auto& glyph = mGlyphPositionsProp[c];
+                auto& glyph = GlyphProp(c);
                 pge->DrawPartialRotatedDecal(pos, fontDecal.get(), fAngle, spos, glyph.first, glyph.second, scale, col);
                 spos.x -= glyph.second.x;
             }
@@ -6,6 +6,7 @@
 #include <vector>
 #include <memory>
 #include "../olcPixelGameEngine.h"
+#include "olcPGEX_FontLayout.h"
 
 namespace olc
 {
@@ -25,14 +26,26 @@ namespace olc
 		void DrawRotatedStringPropDecal(const olc::vf2d& pos, const std::string& sText, const float fAngle, const olc::vf2d& center = {0.0f, 0.0f},  
                                         const Pixel col = olc::WHITE, const olc::vf2d& scale = { 1.0f, 1.0f });
 
+        // Same as DrawStringPropDecal(), but drawn in software into a sprite, for text that is drawn once and kept
+        void DrawStringPropSprite(olc::Sprite* target, const olc::vf2d& pos, const std::string& sText, const Pixel col = olc::WHITE, const olc::vf2d& scale = { 1.0f, 1.0f });
+
+        // The glyphs DrawStringPropDecal() would draw, each as an offset from pos and a part of GetSprite(),
+        // so the text can be drawn some other way. Only good until the next call
+        const olc::TextLayout& GetLayoutProp(const std::string& sText, const olc::vf2d& scale = { 1.0f, 1.0f });
+        olc::Sprite* GetSprite() const;
+
     private:
         std::unique_ptr<olc::Sprite>    fontSprite;
-        std::unique_ptr<olc::Decal>     fontDecal;
+        std::unique_ptr<olc::Decal>     fontDecal; // Only made once text is drawn as decals, so fonts can be used without the renderer
+        olc::Decal* GetDecal();
 
         float                           fCharWidth;
         float                           fCharHeight;
         std::vector<std::pair<olc::vi2d, olc::vi2d> > vGlyphPositionsMono;
         std::vector<std::pair<olc::vi2d, olc::vi2d> > vGlyphPositionsProp;
+
+        olc::TextLayoutCache            layoutsProp;
+        void LayoutProp(olc::TextLayout& layout, const std::string& sText, const olc::vf2d& scale);
     };
 }
 
@@ -45,7 +58,6 @@ namespace olc
 	Font::Font(const std::string& sFontFile, olc::ResourcePack* pack)
 	{
         fontSprite = std::make_unique<olc::Sprite>( sFontFile, pack );
-        fontDecal = std::make_unique<olc::Decal>( fontSprite.get() );
 
         // Get the font information embedded in the last row of pixels
         auto lastRow = fontSprite->height - 1;
@@ -102,20 +114,62 @@ namespace olc
 	}
 
 
-	olc::vi2d Font::GetTextSizeProp(const std::string& s)
+	void Font::LayoutProp(olc::TextLayout& layout, const std::string& sText, const olc::vf2d& scale)
 	{
 		olc::vi2d size = { 0,1 };
 		olc::vi2d pos = { 0,1 };
-		for (auto c : s)
+		olc::vf2d spos = { 0.0f, 0.0f };
+		for (auto c : sText)
 		{
-			if (c == '\n') { pos.y += 1;  pos.x = 0; }
-			else pos.x += vGlyphPositionsProp[c-32].second.x;
+			if (c == '\n')
+			{
+				pos.y += 1;  pos.x = 0;
+				spos.x = 0; spos.y += fCharHeight * scale.y;
+			}
+			else
+			{
+                // Characters the font has no glyph for are left out, as DrawStringPropSprite() does, so text is measured as it is drawn
+                size_t i = size_t((unsigned char)c) - 32;
+                if (i >= vGlyphPositionsProp.size())
+                    continue;
+
+                auto& glyph = vGlyphPositionsProp[i];
+				layout.vGlyphs.emplace_back(spos, &glyph);
+				pos.x += glyph.second.x;
+				spos.x += glyph.second.x * scale.x;
+			}
 			size.x = std::max(size.x, pos.x);
 			size.y = std::max(size.y, pos.y);
 		}
 
 		size.y *= (int)fCharHeight;
-		return size;
+		layout.size = size;
+	}
+
+
+	olc::vi2d Font::GetTextSizeProp(const std::string& s)
+	{
+		return GetLayoutProp(s).size;
+	}
+
+
+	const olc::TextLayout& Font::GetLayoutProp(const std::string& sText, const olc::vf2d& scale)
+	{
+		return layoutsProp.Get(sText, scale, [&](olc::TextLayout& layout) { LayoutProp(layout, sText, scale); });
+	}
+
+
+	olc::Sprite* Font::GetSprite() const
+	{
+		return fontSprite.get();
+	}
+
+
+	olc::Decal* Font::GetDecal()
+	{
+		if (!fontDecal)
+			fontDecal = std::make_unique<olc::Decal>( fontSprite.get() );
+		return fontDecal.get();
 	}
 
 
@@ -131,7 +185,7 @@ namespace olc
 			else
 			{
                 auto& glyph = vGlyphPositionsMono[c-32];
-				pge->DrawPartialDecal(pos + spos, fontDecal.get(), glyph.first, glyph.second, scale, col);
+				pge->DrawPartialDecal(pos + spos, GetDecal(), glyph.first, glyph.second, scale, col);
 				spos.x += fCharWidth * scale.x;
 			}
 		}
@@ -150,7 +204,7 @@ namespace olc
 			else
 			{
                 auto& glyph = vGlyphPositionsMono[c-32];
-				pge->DrawPartialRotatedDecal(pos, fontDecal.get(), fAngle, spos, glyph.first, glyph.second, scale, col);
+				pge->DrawPartialRotatedDecal(pos, GetDecal(), fAngle, spos, glyph.first, glyph.second, scale, col);
 				spos.x -= fCharWidth;
 			}
 		}
@@ -159,41 +213,102 @@ namespace olc
 
 	void Font::DrawStringPropDecal(const olc::vf2d& pos, const std::string& sText, const Pixel col, const olc::vf2d& scale)
 	{
-		olc::vf2d spos = { 0.0f, 0.0f };
+		auto& layout = GetLayoutProp(sText, scale);
+		for (auto& g : layout.vGlyphs)
+			pge->DrawPartialDecal(pos + g.first, GetDecal(), g.second->first, g.second->second, scale, col);
+	}
+
+
+	void Font::DrawRotatedStringPropDecal(const olc::vf2d& pos, const std::string& sText, const float fAngle, const olc::vf2d& center, const Pixel col, const olc::vf2d& scale )
+    {
+		olc::vf2d spos = center;
+
 		for (auto c : sText)
 		{
 			if (c == '\n')
 			{
-				spos.x = 0; spos.y += fCharHeight * scale.y;
+				spos.x = center.x; spos.y -= fCharHeight;
 			}
 			else
 			{
                 auto& glyph = vGlyphPositionsProp[c-32];
-				pge->DrawPartialDecal(pos + spos, fontDecal.get(), glyph.first, glyph.second, scale, col);
-				spos.x += glyph.second.x * scale.x;
+				pge->DrawPartialRotatedDecal(pos, GetDecal(), fAngle, spos, glyph.first, glyph.second, scale, col);
+				spos.x -= glyph.second.x;
 			}
 		}
-	}
+    }
 
 
-	void Font::DrawRotatedStringPropDecal(const olc::vf2d& pos, const std::string& sText, const float fAngle, const olc::vf2d& center, const Pixel col, const olc::vf2d& scale )
-    {
-		olc::vf2d spos = center;
+	void Font::DrawStringPropSprite(olc::Sprite* target, const olc::vf2d& pos, const std::string& sText, const Pixel col, const olc::vf2d& scale)
+	{
+		// Each font texel is spread over the target pixels it lands on by how much of them it covers,
+		// so text drawn well below the font's size stays legible. Premultiplied RGBA, blended in at the end
+		std::vector<float> acc(target->width * target->height * 4, 0.0f);
+
+		auto splat = [&](float x0, float y0, const olc::Pixel& p)
+		{
+			float x1 = x0 + scale.x, y1 = y0 + scale.y;
+			float a = (p.a / 255.0f) * (col.a / 255.0f);
+			float r = a * (p.r / 255.0f) * (col.r / 255.0f);
+			float g = a * (p.g / 255.0f) * (col.g / 255.0f);
+			float b = a * (p.b / 255.0f) * (col.b / 255.0f);
 
+			for (int y = std::max(0, (int)std::floor(y0)); y < std::min(target->height, (int)std::ceil(y1)); y++)
+			{
+				float wy = std::min(y1, y + 1.0f) - std::max(y0, (float)y);
+				for (int x = std::max(0, (int)std::floor(x0)); x < std::min(target->width, (int)std::ceil(x1)); x++)
+				{
+					float w = wy * (std::min(x1, x + 1.0f) - std::max(x0, (float)x));
+					float* dst = acc.data() + (y * target->width + x) * 4;
+					dst[0] += r * w; dst[1] += g * w; dst[2] += b * w; dst[3] += a * w;
+				}
+			}
+		};
+
+		olc::vf2d spos = { 0.0f, 0.0f };
 		for (auto c : sText)
 		{
 			if (c == '\n')
 			{
-				spos.x = center.x; spos.y -= fCharHeight;
+				spos.x = 0; spos.y += fCharHeight * scale.y;
 			}
 			else
 			{
-                auto& glyph = vGlyphPositionsProp[c-32];
-				pge->DrawPartialRotatedDecal(pos, fontDecal.get(), fAngle, spos, glyph.first, glyph.second, scale, col);
-				spos.x -= glyph.second.x;
+                // The font only has glyphs from ' ' on, 96 of them; control characters and bytes past those
+                // (negative, as char is signed on MSVC) have none, so are left out
+                size_t i = size_t((unsigned char)c) - 32;
+                if (i >= vGlyphPositionsProp.size())
+                    continue;
+
+                auto& glyph = vGlyphPositionsProp[i];
+				for (int gy = 0; gy < glyph.second.y; gy++)
+					for (int gx = 0; gx < glyph.second.x; gx++)
+					{
+						olc::Pixel p = fontSprite->GetPixel(glyph.first.x + gx, glyph.first.y + gy);
+						if (p.a > 0)
+							splat(pos.x + spos.x + gx * scale.x, pos.y + spos.y + gy * scale.y, p);
+					}
+				spos.x += glyph.second.x * scale.x;
 			}
 		}
-    }
+
+		// Source over, as a decal would be drawn over the target
+		for (int i = 0; i < target->width * target->height; i++)
+		{
+			const float* src = acc.data() + i * 4;
+			if (src[3] <= 0.0f)
+				continue;
+
+			float a = std::min(1.0f, src[3]);
+			olc::Pixel& dst = target->GetData()[i];
+			float keep = dst.a / 255.0f * (1.0f - a);
+			float outA = a + keep;
+			dst.r = uint8_t(std::min(255.0f, (src[0] + dst.r / 255.0f * keep) / outA * 255.0f));
+			dst.g = uint8_t(std::min(255.0f, (src[1] + dst.g / 255.0f * keep) / outA * 255.0f));
+			dst.b = uint8_t(std::min(255.0f, (src[2] + dst.b / 255.0f * keep) / outA * 255.0f));
+			dst.a = uint8_t(outA * 255.0f);
+		}
+	}
 }
 
 #endif
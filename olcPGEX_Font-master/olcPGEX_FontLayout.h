@@ -0,0 +1,90 @@
+#pragma once
+
+#ifndef __OLC_PGEX_FONTLAYOUT__
+#define __OLC_PGEX_FONTLAYOUT__
+
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../olcPixelGameEngine.h"
+
+namespace olc
+{
+    // A string measured and positioned glyph by glyph, ready to be drawn
+    struct TextLayout
+    {
+        olc::vi2d size;     // Unscaled, as returned by GetTextSizeProp()
+        std::vector<std::pair<olc::vf2d, const std::pair<olc::vi2d, olc::vi2d>*> > vGlyphs; // Offset from the draw position, and the glyph drawn there
+    };
+
+
+    // Small least recently used cache of layouts, keyed by string and scale, so text that is drawn every frame is only laid out once
+    class TextLayoutCache
+    {
+    public:
+        TextLayoutCache(size_t nCapacity = 64) : nCapacity(nCapacity) {}
+
+        // Layout of a string at a scale. If it isn't cached, fnBuild(layout) lays it out, pushing out the least recently used one if full.
+        // The reference is only good until the next call
+        template<typename F>
+        const TextLayout& Get(const std::string& sText, const olc::vf2d& scale, F fnBuild)
+        {
+            size_t nKey = std::hash<std::string>()(sText);
+            nKey = nKey * 31 + std::hash<float>()(scale.x);
+            nKey = nKey * 31 + std::hash<float>()(scale.y);
+
+            auto found = mIndex.find(nKey);
+            if (found != mIndex.end())
+            {
+                auto it = found->second;
+                if (it->scale == scale && it->sText == sText)
+                {
+                    lItems.splice(lItems.begin(), lItems, it);
+                    return it->layout;
+                }
+
+                // Another string with the same key; replace it
+                lItems.erase(it);
+                mIndex.erase(found);
+            }
+
+            if (lItems.size() >= nCapacity)
+            {
+                mIndex.erase(lItems.back().nKey);
+                lItems.pop_back();
+            }
+
+            lItems.emplace_front();
+            entry& e = lItems.front();
+            e.nKey = nKey;
+            e.sText = sText;
+            e.scale = scale;
+            fnBuild(e.layout);
+            mIndex[nKey] = lItems.begin();
+            return e.layout;
+        }
+
+        void Clear()
+        {
+            lItems.clear();
+            mIndex.clear();
+        }
+
+    private:
+        struct entry
+        {
+            size_t      nKey;
+            std::string sText;
+            olc::vf2d   scale;
+            TextLayout  layout;
+        };
+
+        size_t                                                   nCapacity;
+        std::list<entry>                                         lItems;    // Most recently used first
+        std::unordered_map<size_t, std::list<entry>::iterator>   mIndex;
+    };
+}
+
+#endif
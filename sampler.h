@@ -0,0 +1,204 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include "simd.h"
+
+using namespace olc;
+
+//Bilinear texture sampling in 8.8 fixed point, reading straight from the sprite's pixel storage
+//Textures are treated as periodic (they are always set to Sprite::Mode::PERIODIC), and alpha is filtered like any other channel
+namespace sampler
+{
+	//Texel coordinates of the four samples around a point, along with the fractional weights between them
+	struct bilinearTap
+	{
+		int x0, x1, y0, y1;
+		int fx, fy; //0-255
+	};
+
+	inline bilinearTap GetTap(int width, int height, float u, float v)
+	{
+		bilinearTap t;
+
+		//Offset by half a texel so samples are centered; biased up by one texel so truncation rounds down
+		int fu = (int)(u * width * 256.0f + 128.0f);
+		int fv = (int)(v * height * 256.0f + 128.0f);
+
+		t.x0 = (fu >> 8) - 1;
+		t.y0 = (fv >> 8) - 1;
+		t.fx = fu & 0xFF;
+		t.fy = fv & 0xFF;
+
+		//Wrap around the edges; u and v are already in [0, 1)
+		if (t.x0 < 0) t.x0 += width;
+		if (t.y0 < 0) t.y0 += height;
+		if (t.x0 >= width) t.x0 -= width;
+		if (t.y0 >= height) t.y0 -= height;
+		t.x1 = t.x0 + 1 == width ? 0 : t.x0 + 1;
+		t.y1 = t.y0 + 1 == height ? 0 : t.y0 + 1;
+
+		return t;
+	}
+
+	inline Pixel Sample(const Sprite* spr, float u, float v)
+	{
+		const Pixel* data = spr->pColData.data();
+		bilinearTap t = GetTap(spr->width, spr->height, u, v);
+
+		const uint32_t p00 = data[t.y0 * spr->width + t.x0].n;
+		const uint32_t p10 = data[t.y0 * spr->width + t.x1].n;
+		const uint32_t p01 = data[t.y1 * spr->width + t.x0].n;
+		const uint32_t p11 = data[t.y1 * spr->width + t.x1].n;
+
+		//Two channels at a time: 0x00AA00GG and 0x00BB00RR, so each 8-bit product has room to grow into 16 bits
+		auto lerp2 = [](uint32_t a, uint32_t b, uint32_t f)
+		{
+			return ((a * (256 - f) + b * f) >> 8) & 0x00FF00FF;
+		};
+
+		uint32_t top    = lerp2(p00 & 0x00FF00FF, p10 & 0x00FF00FF, t.fx);
+		uint32_t bottom = lerp2(p01 & 0x00FF00FF, p11 & 0x00FF00FF, t.fx);
+		uint32_t rb = lerp2(top, bottom, t.fy);
+
+		top    = lerp2((p00 >> 8) & 0x00FF00FF, (p10 >> 8) & 0x00FF00FF, t.fx);
+		bottom = lerp2((p01 >> 8) & 0x00FF00FF, (p11 >> 8) & 0x00FF00FF, t.fx);
+		uint32_t ga = lerp2(top, bottom, t.fy);
+
+		Pixel res;
+		res.n = rb | (ga << 8);
+		return res;
+	}
+
+#ifdef CV_SSE2
+	//Blends two registers of four RGBA pixels each: (a*(256-f) + b*f) >> 8, with f holding one weight per pixel
+	inline __m128i Lerp4(__m128i a, __m128i b, __m128i f)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i full = _mm_set1_epi16(256);
+
+		//Spread each pixel's weight over its four 16-bit channels
+		__m128i f16 = _mm_or_si128(f, _mm_slli_epi32(f, 16));
+		__m128i fLo = _mm_unpacklo_epi32(f16, f16);
+		__m128i fHi = _mm_unpackhi_epi32(f16, f16);
+
+		__m128i aLo = _mm_unpacklo_epi8(a, zero), aHi = _mm_unpackhi_epi8(a, zero);
+		__m128i bLo = _mm_unpacklo_epi8(b, zero), bHi = _mm_unpackhi_epi8(b, zero);
+
+		//Everything stays below 255*256, so unsigned 16-bit arithmetic cannot overflow
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(aLo, _mm_sub_epi16(full, fLo)), _mm_mullo_epi16(bLo, fLo));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(aHi, _mm_sub_epi16(full, fHi)), _mm_mullo_epi16(bHi, fHi));
+
+		return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+	}
+
+	inline void Sample4(const Sprite* spr, const float* u, const float* v, Pixel* out)
+	{
+		const Pixel* data = spr->pColData.data();
+		alignas(16) uint32_t p00[4], p10[4], p01[4], p11[4];
+		alignas(16) int fx[4], fy[4];
+
+		for (int k = 0; k < 4; k++)
+		{
+			bilinearTap t = GetTap(spr->width, spr->height, u[k], v[k]);
+			const Pixel* row0 = data + t.y0 * spr->width;
+			const Pixel* row1 = data + t.y1 * spr->width;
+			p00[k] = row0[t.x0].n;
+			p10[k] = row0[t.x1].n;
+			p01[k] = row1[t.x0].n;
+			p11[k] = row1[t.x1].n;
+			fx[k] = t.fx;
+			fy[k] = t.fy;
+		}
+
+		__m128i wx = _mm_load_si128((const __m128i*)fx);
+		__m128i wy = _mm_load_si128((const __m128i*)fy);
+		__m128i top    = Lerp4(_mm_load_si128((const __m128i*)p00), _mm_load_si128((const __m128i*)p10), wx);
+		__m128i bottom = Lerp4(_mm_load_si128((const __m128i*)p01), _mm_load_si128((const __m128i*)p11), wx);
+		_mm_storeu_si128((__m128i*)out, Lerp4(top, bottom, wy));
+	}
+#endif
+
+#ifdef CV_AVX2
+	//8-wide version of Lerp4
+	inline __m256i Lerp8(__m256i a, __m256i b, __m256i f)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i full = _mm256_set1_epi16(256);
+
+		__m256i f16 = _mm256_or_si256(f, _mm256_slli_epi32(f, 16));
+		__m256i fLo = _mm256_unpacklo_epi32(f16, f16);
+		__m256i fHi = _mm256_unpackhi_epi32(f16, f16);
+
+		__m256i aLo = _mm256_unpacklo_epi8(a, zero), aHi = _mm256_unpackhi_epi8(a, zero);
+		__m256i bLo = _mm256_unpacklo_epi8(b, zero), bHi = _mm256_unpackhi_epi8(b, zero);
+
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(aLo, _mm256_sub_epi16(full, fLo)), _mm256_mullo_epi16(bLo, fLo));
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(aHi, _mm256_sub_epi16(full, fHi)), _mm256_mullo_epi16(bHi, fHi));
+
+		//Unpack/pack work within 128-bit lanes, so the pixel order comes back out unchanged
+		return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+	}
+
+	inline void Sample8(const Sprite* spr, const float* u, const float* v, Pixel* out)
+	{
+		const int* data = (const int*)spr->pColData.data();
+		const __m256i w = _mm256_set1_epi32(spr->width);
+		const __m256i h = _mm256_set1_epi32(spr->height);
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i mask = _mm256_set1_epi32(0xFF);
+
+		__m256 fu = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(u), _mm256_set1_ps(spr->width * 256.0f)), _mm256_set1_ps(128.0f));
+		__m256 fv = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(v), _mm256_set1_ps(spr->height * 256.0f)), _mm256_set1_ps(128.0f));
+		__m256i iu = _mm256_cvttps_epi32(fu);
+		__m256i iv = _mm256_cvttps_epi32(fv);
+
+		__m256i x0 = _mm256_sub_epi32(_mm256_srai_epi32(iu, 8), one);
+		__m256i y0 = _mm256_sub_epi32(_mm256_srai_epi32(iv, 8), one);
+
+		//Wrap around the edges, same as GetTap()
+		x0 = _mm256_add_epi32(x0, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), x0), w));
+		y0 = _mm256_add_epi32(y0, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), y0), h));
+		x0 = _mm256_sub_epi32(x0, _mm256_andnot_si256(_mm256_cmpgt_epi32(w, x0), w));
+		y0 = _mm256_sub_epi32(y0, _mm256_andnot_si256(_mm256_cmpgt_epi32(h, y0), h));
+		__m256i x1 = _mm256_add_epi32(x0, one);
+		__m256i y1 = _mm256_add_epi32(y0, one);
+		x1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(x1, w), x1);
+		y1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(y1, h), y1);
+
+		__m256i row0 = _mm256_mullo_epi32(y0, w);
+		__m256i row1 = _mm256_mullo_epi32(y1, w);
+
+		__m256i p00 = _mm256_i32gather_epi32(data, _mm256_add_epi32(row0, x0), 4);
+		__m256i p10 = _mm256_i32gather_epi32(data, _mm256_add_epi32(row0, x1), 4);
+		__m256i p01 = _mm256_i32gather_epi32(data, _mm256_add_epi32(row1, x0), 4);
+		__m256i p11 = _mm256_i32gather_epi32(data, _mm256_add_epi32(row1, x1), 4);
+
+		__m256i wx = _mm256_and_si256(iu, mask);
+		__m256i wy = _mm256_and_si256(iv, mask);
+		__m256i top    = Lerp8(p00, p10, wx);
+		__m256i bottom = Lerp8(p01, p11, wx);
+		_mm256_storeu_si256((__m256i*)out, Lerp8(top, bottom, wy));
+	}
+#endif
+
+	//Samples n points from the same sprite, as many at once as the instruction set allows
+	inline void SampleSpan(const Sprite* spr, const float* u, const float* v, Pixel* out, int n)
+	{
+		int k = 0;
+#ifdef CV_AVX2
+		for (; k + 8 <= n; k += 8)
+		{
+			Sample8(spr, u + k, v + k, out + k);
+		}
+#endif
+#ifdef CV_SSE2
+		for (; k + 4 <= n; k += 4)
+		{
+			Sample4(spr, u + k, v + k, out + k);
+		}
+#endif
+		for (; k < n; k++)
+		{
+			out[k] = Sample(spr, u[k], v[k]);
+		}
+	}
+}
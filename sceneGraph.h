@@ -0,0 +1,155 @@
+#pragma once
+#include "types3d.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+//Transform hierarchy with one node per mesh. A node's world matrix is its local matrix, then its parent's world matrix
+//Matrices are only worked out again when a node's own local matrix changes, or one of its parents' does, so nodes that never move cost nothing per frame
+class SceneGraph
+{
+private:
+	struct node
+	{
+		int parent = -1;
+		vector<int> children;
+		mat4x4 local, world;
+		bool dirty = false;
+	};
+
+	vector<node> nodes;
+	vector<int> dirtyNodes; //Nodes whose local matrix has changed since the last Update()
+	vector<int> stack;
+
+	static mat4x4 Identity()
+	{
+		mat4x4 res;
+		res.m[0][0] = 1.0f;
+		res.m[1][1] = 1.0f;
+		res.m[2][2] = 1.0f;
+		res.m[3][3] = 1.0f;
+		return res;
+	}
+
+	void MarkDirty(int i)
+	{
+		if (!nodes[i].dirty)
+		{
+			nodes[i].dirty = true;
+			dirtyNodes.push_back(i);
+		}
+	}
+
+	//Whether a node will already be worked out again as part of a dirty parent's subtree
+	bool HasDirtyParent(int i) const
+	{
+		for (int p = nodes[i].parent; p != -1; p = nodes[p].parent)
+		{
+			if (nodes[p].dirty)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	//Drops any parent links and starts every node off at the origin
+	void Resize(int count)
+	{
+		nodes.assign(count, node());
+		dirtyNodes.clear();
+		for (int i = 0; i < count; i++)
+		{
+			nodes[i].local = nodes[i].world = Identity();
+			MarkDirty(i);
+		}
+	}
+
+	int Size() const
+	{
+		return (int)nodes.size();
+	}
+
+	//Links a node under another, or under nothing with -1. Fails if it would make a loop
+	bool SetParent(int child, int parent)
+	{
+		for (int p = parent; p != -1; p = nodes[p].parent)
+		{
+			if (p == child)
+			{
+				return false;
+			}
+		}
+
+		int old = nodes[child].parent;
+		if (old != -1)
+		{
+			vector<int>& siblings = nodes[old].children;
+			siblings.erase(find(siblings.begin(), siblings.end(), child));
+		}
+
+		nodes[child].parent = parent;
+		if (parent != -1)
+		{
+			nodes[parent].children.push_back(child);
+		}
+		MarkDirty(child);
+		return true;
+	}
+
+	int Parent(int i) const
+	{
+		return nodes[i].parent;
+	}
+
+	//Only marks the node as changed if the matrix really is different, so setting the same one every frame is free
+	void SetLocal(int i, const mat4x4& local)
+	{
+		if (memcmp(nodes[i].local.m, local.m, sizeof(local.m)) != 0)
+		{
+			nodes[i].local = local;
+			MarkDirty(i);
+		}
+	}
+
+	const mat4x4& Local(int i) const
+	{
+		return nodes[i].local;
+	}
+
+	//Works out the world matrices of every changed node and everything under them
+	void Update()
+	{
+		for (int i : dirtyNodes)
+		{
+			if (HasDirtyParent(i))
+			{
+				continue;
+			}
+
+			stack.push_back(i);
+			while (!stack.empty())
+			{
+				node& n = nodes[stack.back()];
+				stack.pop_back();
+
+				n.world = n.parent == -1 ? n.local : n.local * nodes[n.parent].world;
+				stack.insert(stack.end(), n.children.begin(), n.children.end());
+			}
+		}
+
+		for (int i : dirtyNodes)
+		{
+			nodes[i].dirty = false;
+		}
+		dirtyNodes.clear();
+	}
+
+	const mat4x4& World(int i) const
+	{
+		return nodes[i].world;
+	}
+};
@@ -0,0 +1,240 @@
+#pragma once
+#include "types3d.h"
+#include <vector>
+
+using namespace std;
+
+//Depth of the scene as seen by a directional light, looking along the light through an orthographic projection
+//Static geometry is drawn into it once and kept. Anything that moves is drawn over a copy of that every frame;
+//only the area it covered last frame is restored first, so the per-frame cost follows the size of the moving meshes
+class ShadowMap
+{
+private:
+	int size;
+	vector<float> staticDepth; //Static geometry only
+	vector<float> depth;	   //Static geometry plus this frame's moving meshes. Larger is further from the light
+
+	//Light space basis; x and y are in texels, z is distance along the light direction
+	vec3d right, up, forward;
+	float originX = 0.0f, originY = 0.0f, originZ = 0.0f;
+	float texelsPerUnit = 1.0f;
+	float bias = 1.0f;
+
+	vec3d lightDir; //The direction the static depth was drawn for
+	bool valid = false;
+
+	//Area of depth holding moving meshes, inclusive, and the closest they came to the light; then the same for the frame before
+	int dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+	float dirtyMinZ;
+	int prevX0, prevY0, prevX1, prevY1;
+	float prevMinZ;
+
+	//Starts a new frame's dirty area, keeping the last one
+	void ResetDirty()
+	{
+		prevX0 = dirtyX0; prevY0 = dirtyY0;
+		prevX1 = dirtyX1; prevY1 = dirtyY1;
+		prevMinZ = dirtyMinZ;
+		dirtyX0 = dirtyY0 = size;
+		dirtyX1 = dirtyY1 = -1;
+		dirtyMinZ = INFINITY;
+	}
+
+	//Nothing moving in either frame
+	void ClearDirty()
+	{
+		dirtyX0 = dirtyY0 = size;
+		dirtyX1 = dirtyY1 = -1;
+		dirtyMinZ = INFINITY;
+		ResetDirty();
+	}
+
+	//Fills a light space triangle, keeping the depth closest to the light
+	//trackDirty grows the dirty area to cover it
+	void RasterDepth(vector<float>& buf, const vec3d& a, const vec3d& b, const vec3d& c, bool trackDirty)
+	{
+		int x0 = max(0, (int)floor(min(a.x, min(b.x, c.x))));
+		int y0 = max(0, (int)floor(min(a.y, min(b.y, c.y))));
+		int x1 = min(size - 1, (int)ceil(max(a.x, max(b.x, c.x))));
+		int y1 = min(size - 1, (int)ceil(max(a.y, max(b.y, c.y))));
+		if (x0 > x1 || y0 > y1)
+		{
+			return;
+		}
+
+		float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (fabs(area) < 1e-6f)
+		{
+			return;
+		}
+		float invArea = 1.0f / area;
+
+		if (trackDirty)
+		{
+			dirtyX0 = min(dirtyX0, x0);
+			dirtyY0 = min(dirtyY0, y0);
+			dirtyX1 = max(dirtyX1, x1);
+			dirtyY1 = max(dirtyY1, y1);
+			dirtyMinZ = min(dirtyMinZ, min(a.z, min(b.z, c.z)));
+		}
+
+		//Barycentric weights at texel centers, stepped across each row
+		for (int y = y0; y <= y1; y++)
+		{
+			float py = y + 0.5f;
+			float* row = buf.data() + y * size;
+
+			for (int x = x0; x <= x1; x++)
+			{
+				float px = x + 0.5f;
+				float wa = ((b.x - px) * (c.y - py) - (b.y - py) * (c.x - px)) * invArea;
+				float wb = ((c.x - px) * (a.y - py) - (c.y - py) * (a.x - px)) * invArea;
+				float wc = 1.0f - wa - wb;
+
+				if (wa >= 0.0f && wb >= 0.0f && wc >= 0.0f)
+				{
+					float z = wa * a.z + wb * b.z + wc * c.z;
+					row[x] = min(row[x], z);
+				}
+			}
+		}
+	}
+
+public:
+	ShadowMap(int size = 1024)
+		: size(size), staticDepth(size * size, INFINITY), depth(size * size, INFINITY)
+	{
+		ClearDirty();
+	}
+
+	//Static geometry needs drawing again: nothing has been drawn yet, or the light has moved
+	bool NeedsStaticUpdate(const vec3d& sunDir) const
+	{
+		vec3d dir = sunDir.normalized() * -1.0f;
+		return !valid || dir.x != lightDir.x || dir.y != lightDir.y || dir.z != lightDir.z;
+	}
+
+	void Invalidate()
+	{
+		valid = false;
+	}
+
+	//Fits the map around a world space box, as seen from the sun, and clears it ready for the static geometry
+	void BeginStatic(const vec3d& sunDir, const vec3d& boundsMin, const vec3d& boundsMax)
+	{
+		lightDir = sunDir.normalized() * -1.0f;
+		forward = lightDir;
+		vec3d worldUp = fabs(forward.y) > 0.99f ? vec3d(1, 0, 0) : vec3d(0, 1, 0);
+		right = worldUp.cross(forward).normalized();
+		up = forward.cross(right);
+
+		//Extent of the box along each axis of light space
+		float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (int corner = 0; corner < 8; corner++)
+		{
+			vec3d p((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y, (corner & 4) ? boundsMax.z : boundsMin.z);
+			float d[3] = { p.dot(right), p.dot(up), p.dot(forward) };
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = min(lo[k], d[k]);
+				hi[k] = max(hi[k], d[k]);
+			}
+		}
+
+		texelsPerUnit = size / max(1.0f, max(hi[0] - lo[0], hi[1] - lo[1]));
+		originX = lo[0];
+		originY = lo[1];
+		originZ = lo[2];
+
+		//A couple of texels' worth of depth, so surfaces facing the light don't shadow themselves
+		bias = 2.0f / texelsPerUnit;
+
+		fill(staticDepth.begin(), staticDepth.end(), INFINITY);
+	}
+
+	void DrawStatic(const vec3d& a, const vec3d& b, const vec3d& c)
+	{
+		RasterDepth(staticDepth, ToLightSpace(a), ToLightSpace(b), ToLightSpace(c), false);
+	}
+
+	void EndStatic()
+	{
+		depth = staticDepth;
+		ClearDirty();
+		valid = true;
+	}
+
+	//Clears away last frame's moving meshes
+	void BeginDynamic()
+	{
+		for (int y = dirtyY0; y <= dirtyY1; y++)
+		{
+			int i = y * size + dirtyX0;
+			copy(staticDepth.begin() + i, staticDepth.begin() + i + (dirtyX1 - dirtyX0 + 1), depth.begin() + i);
+		}
+		ResetDirty();
+	}
+
+	//Triangle of a moving mesh, already in light space (see ToLightSpace())
+	void DrawDynamic(const vec3d& a, const vec3d& b, const vec3d& c)
+	{
+		RasterDepth(depth, a, b, c, true);
+	}
+
+	//Corners of a world space box around every static surface that moving meshes may have shadowed differently since the frame before
+	//That is under the texels they covered in either frame, between the closest they came to the light and the furthest static surface there
+	//(anything further is in the static geometry's own shadow either way). Returns false if there is no such surface
+	bool DynamicChangeBox(vec3d corners[8]) const
+	{
+		int x0 = min(dirtyX0, prevX0), y0 = min(dirtyY0, prevY0);
+		int x1 = max(dirtyX1, prevX1), y1 = max(dirtyY1, prevY1);
+		if (x0 > x1 || y0 > y1)
+		{
+			return false;
+		}
+
+		float zLo = min(dirtyMinZ, prevMinZ) - bias;
+		float zHi = -INFINITY;
+		for (int y = y0; y <= y1; y++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				float z = staticDepth[y * size + x];
+				if (z != INFINITY)
+				{
+					zHi = max(zHi, z);
+				}
+			}
+		}
+		zHi += bias;
+		if (zHi < zLo)
+		{
+			return false;
+		}
+
+		for (int c = 0; c < 8; c++)
+		{
+			float lx = ((c & 1) ? x1 + 1 : x0) / texelsPerUnit + originX;
+			float ly = ((c & 2) ? y1 + 1 : y0) / texelsPerUnit + originY;
+			float lz = ((c & 4) ? zHi : zLo) + originZ;
+			corners[c] = right * lx + up * ly + forward * lz;
+		}
+		return true;
+	}
+
+	//x and y in texels, z as distance from the light
+	vec3d ToLightSpace(const vec3d& p) const
+	{
+		return vec3d((p.dot(right) - originX) * texelsPerUnit, (p.dot(up) - originY) * texelsPerUnit, p.dot(forward) - originZ);
+	}
+
+	//Whether a light space point can see the light. Anything outside the map is lit
+	bool Lit(float x, float y, float z) const
+	{
+		if (!(x >= 0.0f && y >= 0.0f && x < size && y < size))
+		{
+			return true;
+		}
+		return z <= depth[(int)y * size + (int)x] + bias;
+	}
+};
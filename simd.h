@@ -0,0 +1,12 @@
+#pragma once
+
+//Instruction sets available to the SIMD code paths, decided at compile time
+//MSVC only reports AVX2 through /arch:AVX2, and always has SSE2 on x64
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define CV_SSE2
+	#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+	#define CV_AVX2
+	#include <immintrin.h>
+#endif
@@ -0,0 +1,153 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include <algorithm>
+
+using namespace std;
+using namespace olc;
+
+//Writes shaded spans straight into a sprite's pixel storage, bypassing PixelGameEngine::Draw()
+//The rasterizer has already clipped everything to the screen, so there are no bounds checks here
+namespace span
+{
+	//Same result as PixelGameEngine::Draw() in Pixel::ALPHA mode (with a blend factor of 1), in integer maths
+	inline Pixel BlendAlpha(Pixel src, Pixel dst)
+	{
+		uint32_t a = src.a + (src.a >> 7); //0-255 -> 0-256, so fully opaque pixels come out exact
+		uint32_t ia = 256 - a;
+
+		//Two channels at a time, with room between them for the products
+		uint32_t rb = (((src.n & 0x00FF00FF) * a + (dst.n & 0x00FF00FF) * ia) >> 8) & 0x00FF00FF;
+		uint32_t g  = (((src.n & 0x0000FF00) * a + (dst.n & 0x0000FF00) * ia) >> 8) & 0x0000FF00;
+
+		Pixel res;
+		res.n = rb | g | 0xFF000000;
+		return res;
+	}
+
+	//Scales a colour by a light level per channel, 0-255, keeping the alpha
+	inline Pixel ApplyLight(Pixel p, uint32_t r, uint32_t g, uint32_t b)
+	{
+		p.r = (p.r * (r + (r >> 7))) >> 8; //0-255 -> 0-256, so full light leaves the colour unchanged
+		p.g = (p.g * (g + (g >> 7))) >> 8;
+		p.b = (p.b * (b + (b >> 7))) >> 8;
+		return p;
+	}
+
+	//Linear distance fog between two view space depths
+	struct fog
+	{
+		float start, invRange; //invRange = 1 / (end - start)
+		Pixel col;
+	};
+
+	//0-256 amount of fog at a depth of w (= 1 / z)
+	inline uint32_t FogAmount(const fog& f, float w)
+	{
+		float amt = (1.0f / w - f.start) * f.invRange;
+		return (uint32_t)(max(0.0f, min(1.0f, amt)) * 256.0f);
+	}
+
+	//Fades towards the fog colour, keeping the alpha
+	inline Pixel ApplyFog(Pixel p, const fog& f, uint32_t amt)
+	{
+		uint32_t ia = 256 - amt;
+		uint32_t rb = (((p.n & 0x00FF00FF) * ia + (f.col.n & 0x00FF00FF) * amt) >> 8) & 0x00FF00FF;
+		uint32_t g  = (((p.n & 0x0000FF00) * ia + (f.col.n & 0x0000FF00) * amt) >> 8) & 0x0000FF00;
+
+		Pixel res;
+		res.n = rb | g | (p.n & 0xFF000000);
+		return res;
+	}
+
+	//Fog fades emission out rather than towards the fog colour, so lights don't glow through it
+	inline Pixel FadeEmission(Pixel p, uint32_t amt)
+	{
+		uint32_t ia = 256 - amt;
+		Pixel res;
+		res.n = ((((p.n & 0x00FF00FF) * ia) >> 8) & 0x00FF00FF) | ((((p.n & 0x0000FF00) * ia) >> 8) & 0x0000FF00) | 0xFF000000;
+		return res;
+	}
+
+	//Where the pixels of a span go, starting from the span's first pixel
+	struct output
+	{
+		Pixel* col;
+		float* depth;
+		Pixel* bloom = nullptr; //Emissive spans only
+		float* bloomDepth = nullptr;
+		Pixel emis = BLANK;
+		const fog* fogParams = nullptr; //Fogged spans only
+	};
+
+	//Writes n textured pixels of a span that pass the depth test, x pixels into the span
+	//AlphaTest: only texels of at least half alpha update the depth, so the rest don't hide what is drawn behind them later
+	//Emissive: pixels that update the depth also leave the emissive colour and their depth in the bloom buffers
+	//Cutout: texels below half alpha are discarded entirely
+	//Fog: colours (and emission) are faded by distance before they are written
+	template<bool AlphaBlend, bool AlphaTest, bool Cutout = false, bool Emissive = false, bool Fog = false>
+	inline void Write(const output& out, int x, const Pixel* cols, const float* wTexs, int n)
+	{
+		Pixel* dst = out.col + x;
+		float* depth = out.depth + x;
+
+		for (int k = 0; k < n; k++)
+		{
+			if (wTexs[k] > depth[k])
+			{
+				Pixel col = cols[k];
+				if (Cutout && col.a < 128)
+				{
+					continue;
+				}
+
+				uint32_t fogAmt = 0;
+				if (Fog)
+				{
+					fogAmt = FogAmount(*out.fogParams, wTexs[k]);
+					col = ApplyFog(col, *out.fogParams, fogAmt);
+				}
+
+				dst[k] = AlphaBlend ? BlendAlpha(col, dst[k]) : col;
+				if (!AlphaTest || col.a >= 128)
+				{
+					depth[k] = wTexs[k];
+					if (Emissive)
+					{
+						out.bloom[x + k] = Fog ? FadeEmission(out.emis, fogAmt) : out.emis;
+						out.bloomDepth[x + k] = wTexs[k];
+					}
+				}
+			}
+		}
+	}
+
+	//Solid colour span, with depth interpolated linearly from w, for pixels from (inclusive) to to (exclusive) along it
+	template<bool Emissive = false, bool Fog = false>
+	inline void FillOpaque(const output& out, Pixel col, float w0, float wStep, int from, int to)
+	{
+		for (int k = from; k < to; k++)
+		{
+			float w = w0 + k * wStep;
+			if (w > out.depth[k])
+			{
+				uint32_t fogAmt = 0;
+				if (Fog)
+				{
+					fogAmt = FogAmount(*out.fogParams, w);
+					out.col[k] = ApplyFog(col, *out.fogParams, fogAmt);
+				}
+				else
+				{
+					out.col[k] = col;
+				}
+				out.depth[k] = w;
+
+				if (Emissive)
+				{
+					out.bloom[k] = Fog ? FadeEmission(out.emis, fogAmt) : out.emis;
+					out.bloomDepth[k] = w;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include "olcPixelGameEngine.h"
+#include "olcPGEX_Font-master/olcPGEX_Font.h"
+#include "types3d.h"
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+using namespace std;
+using namespace olc;
+
+//Info point text boxes (background, title and description), each drawn once into a sprite and kept while it is on screen
+//They are drawn at whole steps of scale, and stretched a little to the exact one, so one only needs drawing again when its scale crosses a step
+class TextPanels
+{
+public:
+	struct panel
+	{
+		string title, description; //What was drawn, in case two texts' keys collide
+		vi2d borderSize;
+		float scale = 1.0f;	//Scale the panel was drawn at
+		int lastUsed = 0;	//Frame it was last drawn on screen
+
+		unique_ptr<Sprite> sprite;
+		unique_ptr<Decal> decal; //Declared after sprite, so it is destroyed first
+
+		//Only made once the panel is drawn as a decal, so panels drawn in software never need the renderer
+		Decal* GetDecal()
+		{
+			if (!decal)
+			{
+				decal = make_unique<Decal>(sprite.get(), true);
+			}
+			return decal.get();
+		}
+	};
+
+	const float step = 1.0f / 16.0f;
+	const int keepFrames = 120; //Panels not on screen for this many frames are let go
+
+private:
+	unordered_map<size_t, panel> panels;
+	int frame = 0;
+
+	static size_t Key(const text& tx, int bucket)
+	{
+		hash<string> h;
+		size_t key = h(tx.title);
+		key = key * 31 + h(tx.description);
+		key = key * 31 + (size_t)(tx.borderSize.x * 65536 + tx.borderSize.y);
+		return key * 31 + bucket;
+	}
+
+	//Same layout as the text was given when it was drawn straight to the screen
+	void Draw(panel& p, Font& titleFont, Font& descFont, const text& tx)
+	{
+		vi2d titleSize = titleFont.GetTextSizeProp(tx.title);
+		titleSize = vi2d(titleSize.x * p.scale, titleSize.y * p.scale);
+
+		vi2d descSize = descFont.GetTextSizeProp(tx.description);
+		descSize = vi2d(descSize.x * 0.25f * p.scale, descSize.y * 0.25f * p.scale);
+
+		vi2d boxSize = vi2d(max(titleSize.x, descSize.x) + tx.borderSize.x, titleSize.y + descSize.y + tx.borderSize.y);
+
+		p.decal.reset(); //Made again from the new sprite if it is needed
+		p.sprite = make_unique<Sprite>(max(1, boxSize.x), max(1, boxSize.y));
+		fill(p.sprite->GetData(), p.sprite->GetData() + p.sprite->width * p.sprite->height, Pixel(255, 255, 255, 230));
+
+		titleFont.DrawStringPropSprite(p.sprite.get(), tx.borderSize / 2, tx.title, BLACK, vf2d(p.scale, p.scale));
+		descFont.DrawStringPropSprite(p.sprite.get(), vi2d(2, titleSize.y) + tx.borderSize / 2, tx.description, BLACK, vf2d(0.25f * p.scale, 0.25f * p.scale));
+	}
+
+public:
+	//Panel for a text shown at a scale, drawn now if there isn't one for its step yet
+	//The panel's scale is the step it was drawn at, rounded up so it is only ever shrunk to fit
+	panel& Get(Font& titleFont, Font& descFont, const text& tx, float scale)
+	{
+		int bucket = max(1, (int)ceil(scale / step));
+		panel& p = panels[Key(tx, bucket)];
+
+		if (!p.sprite || p.title != tx.title || p.description != tx.description || p.borderSize != tx.borderSize)
+		{
+			p.title = tx.title;
+			p.description = tx.description;
+			p.borderSize = tx.borderSize;
+			p.scale = bucket * step;
+			Draw(p, titleFont, descFont, tx);
+		}
+
+		p.lastUsed = frame;
+		return p;
+	}
+
+	//Lets go of panels that haven't been shown for a while
+	void EndFrame()
+	{
+		for (auto it = panels.begin(); it != panels.end();)
+		{
+			if (frame - it->second.lastUsed > keepFrames)
+			{
+				it = panels.erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+		frame++;
+	}
+
+	void Clear()
+	{
+		panels.clear();
+	}
+};
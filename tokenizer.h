@@ -0,0 +1,243 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+//A word from a line, pointing into the tokenizer's copy of the file rather than copied out of it
+//Only valid until the tokenizer is opened on another file or destroyed
+struct token
+{
+	const char* start = "";
+	size_t length = 0;
+
+	bool empty() const
+	{
+		return length == 0;
+	}
+
+	bool operator==(const char* s) const
+	{
+		return strlen(s) == length && memcmp(start, s, length) == 0;
+	}
+
+	bool operator!=(const char* s) const
+	{
+		return !(*this == s);
+	}
+
+	string str() const
+	{
+		return string(start, length);
+	}
+};
+
+//Thrown for a line that can't be understood, with the file and line number it is on
+class parseError : public runtime_error
+{
+public:
+	parseError(const string& fileName, int line, const string& message)
+		: runtime_error(fileName + ":" + to_string(line) + ": " + message)
+	{}
+};
+
+//Splits a text file into lines and whitespace separated words, reading the whole file in at once
+//Words and numbers are read straight out of that one copy, so going through a file allocates nothing per line
+class Tokenizer
+{
+private:
+	string fileName;
+	string contents;
+	const char* next = nullptr;	   //Start of the line after this one
+	const char* pos = nullptr;	   //Where the next word is looked for
+	const char* lineEnd = nullptr; //The newline (or end of file) ending this line
+	int lineNumber = 0;
+
+	static bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	//The next word, which has to be there and start with a number. Anything after the number in the word is ignored, as with stoi()/stof()
+	template<typename T, typename Parse>
+	T Number(Parse parse)
+	{
+		token w = Word();
+		char* end;
+		T res = w.empty() ? T() : (T)parse(w.start, &end);
+		if (w.empty() || end == w.start)
+		{
+			Error(w.empty() ? "expected a number" : "expected a number, not \"" + w.str() + "\"");
+		}
+		return res;
+	}
+
+public:
+	//Returns false if the file can't be read
+	bool Open(const string& fn)
+	{
+		ifstream f(fn, ios::binary);
+		if (!f.is_open())
+		{
+			return false;
+		}
+
+		fileName = fn;
+		f.seekg(0, ios::end);
+		contents.resize((size_t)f.tellg());
+		f.seekg(0, ios::beg);
+		f.read(&contents[0], contents.size());
+
+		next = pos = lineEnd = contents.c_str();
+		lineNumber = 0;
+		return true;
+	}
+
+	//Moves on to the next line. False once there are none left
+	bool NextLine()
+	{
+		const char* fileEnd = contents.c_str() + contents.size();
+		if (next == nullptr || next >= fileEnd)
+		{
+			return false;
+		}
+
+		pos = next;
+		lineEnd = (const char*)memchr(pos, '\n', fileEnd - pos);
+		if (lineEnd == nullptr)
+		{
+			lineEnd = fileEnd;
+		}
+		next = lineEnd + 1;
+		lineNumber++;
+		return true;
+	}
+
+	int Line() const
+	{
+		return lineNumber;
+	}
+
+	//The next word on this line, or an empty token once there are none left
+	token Word()
+	{
+		while (pos < lineEnd && IsSpace(*pos))
+		{
+			pos++;
+		}
+
+		token w;
+		w.start = pos;
+		while (pos < lineEnd && !IsSpace(*pos))
+		{
+			pos++;
+		}
+		w.length = pos - w.start;
+		return w;
+	}
+
+	//Everything left on this line after the space following the last word, spaces and all
+	token Rest()
+	{
+		if (pos < lineEnd && IsSpace(*pos))
+		{
+			pos++;
+		}
+
+		token w;
+		w.start = pos;
+		w.length = lineEnd - pos;
+		if (w.length > 0 && w.start[w.length - 1] == '\r')
+		{
+			w.length--;
+		}
+		pos = lineEnd;
+		return w;
+	}
+
+	//Whether there are no words left on this line
+	bool AtLineEnd()
+	{
+		while (pos < lineEnd && IsSpace(*pos))
+		{
+			pos++;
+		}
+		return pos == lineEnd;
+	}
+
+	//Plain decimals like "-12.375", which is what the scene files are full of, are worked out here rather than with strtof(), which is far slower
+	//Up to 15 digits fit exactly in a double, as do powers of ten up to 10^15, so dividing one by the other rounds only once
+	//Rounding that to a float again only gives a different answer from strtof() when the double lands right between two floats, so those are left to it
+	float Float()
+	{
+		static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+
+		const char* p = pos;
+		while (p < lineEnd && IsSpace(*p))
+		{
+			p++;
+		}
+		bool negative = p < lineEnd && *p == '-';
+		p += p < lineEnd && (*p == '-' || *p == '+');
+
+		unsigned long long digits = 0;
+		int numDigits = 0, fracDigits = 0;
+		bool point = false;
+		for (; p < lineEnd && numDigits <= 15; p++)
+		{
+			if (*p >= '0' && *p <= '9')
+			{
+				digits = digits * 10 + (*p - '0');
+				numDigits++;
+				fracDigits += point;
+			}
+			else if (*p == '.' && !point)
+			{
+				point = true;
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		if (numDigits > 0 && numDigits <= 15 && (p == lineEnd || IsSpace(*p)))
+		{
+			double res = (double)digits / powersOf10[fracDigits];
+			uint64_t bits;
+			memcpy(&bits, &res, sizeof(res));
+			uint64_t dropped = bits & ((1ull << 29) - 1); //Mantissa bits that don't fit in a float
+			if (dropped - ((1ull << 28) - 1) > 2)
+			{
+				pos = p;
+				return (float)(negative ? -res : res);
+			}
+		}
+		return Number<float>(strtof);
+	}
+
+	//Or "otherwise" if the line has no words left
+	float Float(float otherwise)
+	{
+		return AtLineEnd() ? otherwise : Float();
+	}
+
+	int Int()
+	{
+		return Number<int>([](const char* s, char** end) { return strtol(s, end, 10); });
+	}
+
+	int Int(int otherwise)
+	{
+		return AtLineEnd() ? otherwise : Int();
+	}
+
+	[[noreturn]] void Error(const string& message) const
+	{
+		throw parseError(fileName, lineNumber, message);
+	}
+};
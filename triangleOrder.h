@@ -0,0 +1,246 @@
+#pragma once
+#include "types3d.h"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+//Average cache miss ratio: vertices transformed per triangle when drawing "indices" in order through a first in, first out cache of "cacheSize" transformed vertices
+//3 means no vertex is ever reused; around 0.5 is the best a closed mesh can do
+static float CacheMissRatio(const vector<int>& indices, int numVerts, int cacheSize)
+{
+	if (indices.empty())
+	{
+		return 0.0f;
+	}
+
+	vector<int> addedAt(numVerts, -cacheSize - 1); //When each vertex last went into the cache
+	int added = 0;
+	for (int v : indices)
+	{
+		if (added - addedAt[v] > cacheSize)
+		{
+			addedAt[v] = added++;
+		}
+	}
+	return (float)added / (int)(indices.size() / 3);
+}
+
+//Tipsify (Sander, Nehab and Barczak, 2007): draws every triangle around one vertex, then moves on to whichever of their vertices will still be in the cache
+//with triangles left, or back along the way it came when there are none. Returns the triangle order, and where it had to jump in "jumps"
+static vector<int> TipsifyOrder(const vector<int>& indices, int numVerts, int cacheSize, vector<int>& jumps)
+{
+	int numTris = (int)indices.size() / 3;
+
+	//Triangles around each vertex
+	vector<int> firstAdj(numVerts + 1, 0), adj(indices.size());
+	for (int v : indices)
+	{
+		firstAdj[v + 1]++;
+	}
+	for (int v = 0; v < numVerts; v++)
+	{
+		firstAdj[v + 1] += firstAdj[v];
+	}
+	vector<int> live(numVerts), slot(firstAdj.begin(), firstAdj.end() - 1);
+	for (int t = 0; t < numTris; t++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int v = indices[t * 3 + c];
+			adj[slot[v]++] = t;
+			live[v]++;
+		}
+	}
+
+	vector<int> order, candidates, deadEnds;
+	vector<int> addedAt(numVerts, -cacheSize - 1);
+	vector<bool> drawn(numTris, false);
+	int added = 0, cursor = 0;
+
+	order.reserve(numTris);
+	for (int fan = 0; fan != -1;)
+	{
+		candidates.clear();
+		for (int a = firstAdj[fan]; a < firstAdj[fan + 1]; a++)
+		{
+			int t = adj[a];
+			if (drawn[t])
+			{
+				continue;
+			}
+
+			for (int c = 0; c < 3; c++)
+			{
+				int v = indices[t * 3 + c];
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (added - addedAt[v] > cacheSize)
+				{
+					addedAt[v] = added++;
+				}
+			}
+			drawn[t] = true;
+			order.push_back(t);
+		}
+
+		//The oldest vertex that will still be in the cache once its own triangles are drawn too
+		int next = -1, bestAge = -1;
+		for (int v : candidates)
+		{
+			if (live[v] == 0)
+			{
+				continue;
+			}
+			int age = added - addedAt[v];
+			int priority = age + 2 * live[v] <= cacheSize ? age : 0;
+			if (priority > bestAge)
+			{
+				next = v;
+				bestAge = priority;
+			}
+		}
+
+		if (next == -1)
+		{
+			//Dead end: back to a recently used vertex with triangles left, else the next one anywhere
+			while (!deadEnds.empty() && next == -1)
+			{
+				next = live[deadEnds.back()] > 0 ? deadEnds.back() : -1;
+				deadEnds.pop_back();
+			}
+			while (next == -1 && cursor < numVerts)
+			{
+				next = live[cursor] > 0 ? cursor : -1;
+				cursor++;
+			}
+			if (next != -1 && !order.empty())
+			{
+				jumps.push_back((int)order.size());
+			}
+		}
+		fan = next;
+	}
+	return order;
+}
+
+//Puts a mesh's triangles in an order that reuses transformed vertices, then renumbers its vertices in the order they are first used, so they are read in order too
+//The triangles are also split into clusters, which are drawn outside in: the ones facing away from the middle of the mesh are the ones most likely
+//to cover the rest, whichever way the mesh is seen from, so drawing them first means less is drawn only to be drawn over
+//Returns the average cache miss ratio before and after
+static void OptimizeTriangleOrder(mesh& m, int cacheSize, float& missRatioBefore, float& missRatioAfter)
+{
+	int numTris = (int)m.tris.size(), numVerts = (int)m.verts.size();
+	missRatioBefore = missRatioAfter = CacheMissRatio(m.indices, numVerts, cacheSize);
+	if (numTris < 2 || (int)m.indices.size() != numTris * 3)
+	{
+		return;
+	}
+
+	vector<int> jumps;
+	vector<int> order = TipsifyOrder(m.indices, numVerts, cacheSize, jumps);
+
+	vector<int> ordered;
+	ordered.reserve(numTris * 3);
+	for (int t : order)
+	{
+		ordered.insert(ordered.end(), m.indices.begin() + t * 3, m.indices.begin() + t * 3 + 3);
+	}
+
+	//Clusters start wherever Tipsify jumped, and wherever a cluster already reuses vertices as well as the mesh does on average,
+	//so that starting another one, and having to fill the cache again, costs little
+	const int minClusterTris = 64;
+	float missRatio = CacheMissRatio(ordered, numVerts, cacheSize);
+	vector<int> clusterStarts = { 0 };
+	{
+		vector<int> addedAt(numVerts, -cacheSize - 1);
+		int added = 0, clusterAdded = 0;
+		size_t nextJump = 0;
+		for (int i = 0; i < numTris; i++)
+		{
+			int clusterTris = i - clusterStarts.back();
+			bool jumped = nextJump < jumps.size() && jumps[nextJump] == i;
+			nextJump += jumped;
+			if (jumped || (clusterTris >= minClusterTris && clusterAdded < missRatio * clusterTris))
+			{
+				clusterStarts.push_back(i);
+				clusterAdded = 0;
+			}
+
+			for (int c = 0; c < 3; c++)
+			{
+				int v = ordered[i * 3 + c];
+				if (added - addedAt[v] > cacheSize)
+				{
+					addedAt[v] = added++;
+					clusterAdded++;
+				}
+			}
+		}
+	}
+	clusterStarts.push_back(numTris);
+
+	//Area weighted middle of the mesh, and the middle and direction of each cluster
+	int numClusters = (int)clusterStarts.size() - 1;
+	vector<vec3d> clusterMids(numClusters), clusterNormals(numClusters);
+	vec3d meshMid;
+	float meshArea = 0.0f;
+	for (int k = 0; k < numClusters; k++)
+	{
+		float area = 0.0f;
+		for (int i = clusterStarts[k]; i < clusterStarts[k + 1]; i++)
+		{
+			const triangle& tri = m.tris[order[i]];
+			vec3d normal = (tri.p[1] - tri.p[0]).cross(tri.p[2] - tri.p[0]); //Twice the area long
+			vec3d mid = (tri.p[0] + tri.p[1] + tri.p[2]) / 3.0f;
+			float a = normal.length();
+			clusterMids[k] += mid * a;
+			clusterNormals[k] += normal;
+			area += a;
+		}
+		meshMid += clusterMids[k];
+		meshArea += area;
+		clusterMids[k] = area > 0.0f ? clusterMids[k] / area : m.tris[order[clusterStarts[k]]].p[0];
+	}
+	meshMid = meshArea > 0.0f ? meshMid / meshArea : m.boundsCenter;
+
+	vector<float> outwards(numClusters);
+	vector<int> clusters(numClusters);
+	for (int k = 0; k < numClusters; k++)
+	{
+		float len = clusterNormals[k].length();
+		outwards[k] = len > 0.0f ? (clusterMids[k] - meshMid).dot(clusterNormals[k] / len) : 0.0f;
+		clusters[k] = k;
+	}
+	stable_sort(clusters.begin(), clusters.end(), [&](int a, int b) { return outwards[a] > outwards[b]; });
+
+	//Put the triangles in their new order, with their vertices numbered by first use
+	vector<triangle> tris;
+	vector<vec3d> verts;
+	vector<int> indices, newIndex(numVerts, -1);
+	tris.reserve(numTris);
+	indices.reserve(numTris * 3);
+	for (int k : clusters)
+	{
+		for (int i = clusterStarts[k]; i < clusterStarts[k + 1]; i++)
+		{
+			tris.push_back(m.tris[order[i]]);
+			for (int c = 0; c < 3; c++)
+			{
+				int v = ordered[i * 3 + c];
+				if (newIndex[v] == -1)
+				{
+					newIndex[v] = (int)verts.size();
+					verts.push_back(m.verts[v]);
+				}
+				indices.push_back(newIndex[v]);
+			}
+		}
+	}
+
+	m.tris = move(tris);
+	m.verts = move(verts);
+	m.indices = move(indices);
+	missRatioAfter = CacheMissRatio(m.indices, (int)m.verts.size(), cacheSize);
+}
@@ -1,7 +1,10 @@
 #pragma once
 #include "olcPixelGameEngine.h"
+#include "simd.h"
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <memory>
 
 using namespace std;
 using namespace olc;
@@ -20,6 +23,9 @@ struct intPair
 	};
 };
 
+//Each matrix row (or vector) is four floats, so it loads into one SSE register. Loads are unaligned, since 32 bit MSVC can't pass
+//over-aligned types by value and neither new nor vector align them before C++17; on anything recent they cost the same as aligned ones
+//The SSE paths add up in the same order as the scalar ones, so they give the same results to the bit
 struct mat4x4
 {
 	float m[4][4] = { 0 }; //[row][col]
@@ -27,9 +33,22 @@ struct mat4x4
 	mat4x4 operator*(const mat4x4& a) const
 	{
 		mat4x4 matrix;
+#ifdef CV_SSE2
+		//Each row of the result is this row's elements times a's rows, added up
+		__m128 a0 = _mm_loadu_ps(a.m[0]), a1 = _mm_loadu_ps(a.m[1]), a2 = _mm_loadu_ps(a.m[2]), a3 = _mm_loadu_ps(a.m[3]);
+		for (int r = 0; r < 4; r++)
+		{
+			__m128 row = _mm_mul_ps(_mm_set1_ps(m[r][0]), a0);
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[r][1]), a1));
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[r][2]), a2));
+			row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[r][3]), a3));
+			_mm_storeu_ps(matrix.m[r], row);
+		}
+#else
 		for (int c = 0; c < 4; c++)
 			for (int r = 0; r < 4; r++)
 				matrix.m[r][c] = m[r][0] * a.m[0][c] + m[r][1] * a.m[1][c] + m[r][2] * a.m[2][c] + m[r][3] * a.m[3][c];
+#endif
 		return matrix;
 	}
 
@@ -143,11 +162,6 @@ struct vec2d
 #pragma endregion
 };
 
-struct quaternion
-{
-
-};
-
 struct vec3d
 {
 	union
@@ -169,14 +183,33 @@ struct vec3d
 		: x(x), y(y), z(z), w(1)
 	{}
 
+#ifdef CV_SSE2
+	vec3d(__m128 v)
+	{
+		_mm_storeu_ps(n, v);
+	}
+
+	__m128 load() const
+	{
+		return _mm_loadu_ps(n);
+	}
+#endif
+
 	float length() const
 	{
-		return sqrtf(x * x + y * y + z * z);
+		return sqrtf(dot(*this));
 	}
 
 	vec3d normalized() const
 	{
+#ifdef CV_SSE2
+		__m128 len = _mm_set1_ps(length());
+		vec3d res(_mm_div_ps(load(), len));
+		res.w = 1;
+		return res;
+#else
 		return *this / length();
+#endif
 	}
 
 	float angle(const vec3d& a) const
@@ -186,20 +219,36 @@ struct vec3d
 
 	float dot(const vec3d& a) const
 	{
+#ifdef CV_SSE2
+		__m128 p = _mm_mul_ps(load(), a.load());
+		__m128 sum = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2))));
+#else
 		return (x * a.x + y * a.y + z * a.z);
+#endif
 	}
 
 	vec3d cross(const vec3d& a) const
 	{
+#ifdef CV_SSE2
+		//(y, z, x) * (a.z, a.x, a.y) - (z, x, y) * (a.y, a.z, a.x)
+		__m128 u = load(), v = a.load();
+		__m128 uYZX = _mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 0, 2, 1)), vYZX = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 uZXY = _mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 1, 0, 2)), vZXY = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2));
+		vec3d res(_mm_sub_ps(_mm_mul_ps(uYZX, vZXY), _mm_mul_ps(uZXY, vYZX)));
+		res.w = 1;
+		return res;
+#else
 		return {
 			n[1] * a.n[2] - n[2] * a.n[1],
 			n[2] * a.n[0] - n[0] * a.n[2],
 			n[0] * a.n[1] - n[1] * a.n[0],
 			1
 		};
+#endif
 	}
 
-	vec3d lerp(const vec3d& a, float t)
+	vec3d lerp(const vec3d& a, float t) const
 	{
 		return {
 			x + (a.x-x)*t,
@@ -219,12 +268,19 @@ struct vec3d
 	//Returns the product of the current vector with the specified matrix
 	vec3d operator*(const mat4x4& m) const
 	{
+#ifdef CV_SSE2
+		__m128 res = _mm_mul_ps(_mm_set1_ps(x), _mm_loadu_ps(m.m[0]));
+		res = _mm_add_ps(res, _mm_mul_ps(_mm_set1_ps(y), _mm_loadu_ps(m.m[1])));
+		res = _mm_add_ps(res, _mm_mul_ps(_mm_set1_ps(z), _mm_loadu_ps(m.m[2])));
+		return vec3d(_mm_add_ps(res, _mm_loadu_ps(m.m[3])));
+#else
 		return vec3d(
 						(x * m.m[0][0]) + (y * m.m[1][0]) + (z * m.m[2][0]) + (m.m[3][0]),
 						(x * m.m[0][1]) + (y * m.m[1][1]) + (z * m.m[2][1]) + (m.m[3][1]),
 						(x * m.m[0][2]) + (y * m.m[1][2]) + (z * m.m[2][2]) + (m.m[3][2]),
 						(x * m.m[0][3]) + (y * m.m[1][3]) + (z * m.m[2][3]) + (m.m[3][3])
 					);
+#endif
 	}
 
 	vec3d operator+(const vec3d& rhs) const
@@ -290,18 +346,187 @@ struct vec3d
 #pragma endregion
 };
 
+//Rotation, turning points the same way as v' = q v q*
+//q * r turns by r, then by q, so its matrix is r's matrix then q's, in the order mat4x4s are multiplied
+struct quaternion
+{
+	float x, y, z, w;
+
+	quaternion()
+		: x(0), y(0), z(0), w(1)
+	{}
+
+	quaternion(float x, float y, float z, float w)
+		: x(x), y(y), z(z), w(w)
+	{}
+
+	//Turns by angle radians around a unit length axis
+	quaternion(const vec3d& axis, float angle)
+	{
+		float s = sinf(angle * 0.5f);
+		x = axis.x * s;
+		y = axis.y * s;
+		z = axis.z * s;
+		w = cosf(angle * 0.5f);
+	}
+
+	float dot(const quaternion& a) const
+	{
+		return x * a.x + y * a.y + z * a.z + w * a.w;
+	}
+
+	quaternion normalized() const
+	{
+		float len = sqrtf(dot(*this));
+		return quaternion(x / len, y / len, z / len, w / len);
+	}
+
+	//Straight line between the two, normalized; close enough to slerp() for small turns, and cheaper
+	static quaternion nlerp(const quaternion& a, quaternion b, float t)
+	{
+		if (a.dot(b) < 0.0f) //q and -q are the same turn; go the short way round
+		{
+			b = quaternion(-b.x, -b.y, -b.z, -b.w);
+		}
+		return quaternion(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t).normalized();
+	}
+
+	//Turns from a to b at a constant rate, the short way round
+	static quaternion slerp(const quaternion& a, quaternion b, float t)
+	{
+		float cosAngle = a.dot(b);
+		if (cosAngle < 0.0f)
+		{
+			b = quaternion(-b.x, -b.y, -b.z, -b.w);
+			cosAngle = -cosAngle;
+		}
+
+		if (cosAngle > 0.9995f) //Almost the same turn, where sinAngle below is too small to divide by
+		{
+			return nlerp(a, b, t);
+		}
+
+		float angle = acosf(cosAngle);
+		float sinAngle = sinf(angle);
+		float wa = sinf((1.0f - t) * angle) / sinAngle;
+		float wb = sinf(t * angle) / sinAngle;
+		return quaternion(a.x * wa + b.x * wb, a.y * wa + b.y * wb, a.z * wa + b.z * wb, a.w * wa + b.w * wb);
+	}
+
+	//Rotation matrix for points multiplied on the left, as with vec3d * mat4x4
+	mat4x4 toMatrix() const
+	{
+		mat4x4 res;
+		float xx = x * x, yy = y * y, zz = z * z;
+		float xy = x * y, xz = x * z, yz = y * z;
+		float xw = x * w, yw = y * w, zw = z * w;
+
+		res.m[0][0] = 1.0f - 2.0f * (yy + zz);
+		res.m[0][1] = 2.0f * (xy + zw);
+		res.m[0][2] = 2.0f * (xz - yw);
+		res.m[1][0] = 2.0f * (xy - zw);
+		res.m[1][1] = 1.0f - 2.0f * (xx + zz);
+		res.m[1][2] = 2.0f * (yz + xw);
+		res.m[2][0] = 2.0f * (xz + yw);
+		res.m[2][1] = 2.0f * (yz - xw);
+		res.m[2][2] = 1.0f - 2.0f * (xx + yy);
+		res.m[3][3] = 1.0f;
+		return res;
+	}
+
+	//The turn made by the top left 3x3 of a matrix, which must be a rotation (no scale or skew)
+	static quaternion fromMatrix(const mat4x4& mat)
+	{
+		const float (&m)[4][4] = mat.m;
+		float trace = m[0][0] + m[1][1] + m[2][2];
+		quaternion q;
+
+		//Worked out from whichever of w, x, y, z is largest, to keep away from dividing by a small number
+		if (trace > 0.0f)
+		{
+			float s = sqrtf(trace + 1.0f) * 2.0f;
+			q = quaternion((m[1][2] - m[2][1]) / s, (m[2][0] - m[0][2]) / s, (m[0][1] - m[1][0]) / s, 0.25f * s);
+		}
+		else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+		{
+			float s = sqrtf(1.0f + m[0][0] - m[1][1] - m[2][2]) * 2.0f;
+			q = quaternion(0.25f * s, (m[0][1] + m[1][0]) / s, (m[0][2] + m[2][0]) / s, (m[1][2] - m[2][1]) / s);
+		}
+		else if (m[1][1] > m[2][2])
+		{
+			float s = sqrtf(1.0f + m[1][1] - m[0][0] - m[2][2]) * 2.0f;
+			q = quaternion((m[0][1] + m[1][0]) / s, 0.25f * s, (m[1][2] + m[2][1]) / s, (m[2][0] - m[0][2]) / s);
+		}
+		else
+		{
+			float s = sqrtf(1.0f + m[2][2] - m[0][0] - m[1][1]) * 2.0f;
+			q = quaternion((m[0][2] + m[2][0]) / s, (m[1][2] + m[2][1]) / s, 0.25f * s, (m[0][1] - m[1][0]) / s);
+		}
+		return q.normalized();
+	}
+
+	//Point turned by the quaternion
+	vec3d rotate(const vec3d& v) const
+	{
+		vec3d u(x, y, z);
+		vec3d t = u.cross(v) * 2.0f;
+		return v + t * w + u.cross(t);
+	}
+
+#pragma region Operator Overloads
+	quaternion operator*(const quaternion& rhs) const
+	{
+		return quaternion(
+							w * rhs.x + x * rhs.w + y * rhs.z - z * rhs.y,
+							w * rhs.y - x * rhs.z + y * rhs.w + z * rhs.x,
+							w * rhs.z + x * rhs.y - y * rhs.x + z * rhs.w,
+							w * rhs.w - x * rhs.x - y * rhs.y - z * rhs.z
+						 );
+	}
+	quaternion& operator*=(const quaternion& rhs)
+	{
+		*this = *this * rhs;
+		return *this;
+	}
+#pragma endregion
+};
+
+//out[i] = in[i] * m for count points, keeping the matrix's rows in registers across all of them
+//in and out may be the same array
+inline void TransformPoints(const vec3d* in, vec3d* out, int count, const mat4x4& m)
+{
+#ifdef CV_SSE2
+	__m128 r0 = _mm_loadu_ps(m.m[0]), r1 = _mm_loadu_ps(m.m[1]), r2 = _mm_loadu_ps(m.m[2]), r3 = _mm_loadu_ps(m.m[3]);
+	for (int i = 0; i < count; i++)
+	{
+		__m128 p = in[i].load();
+		__m128 res = _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)), r0);
+		res = _mm_add_ps(res, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)), r1));
+		res = _mm_add_ps(res, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2)), r2));
+		_mm_storeu_ps(out[i].n, _mm_add_ps(res, r3));
+	}
+#else
+	for (int i = 0; i < count; i++)
+	{
+		out[i] = in[i] * m;
+	}
+#endif
+}
+
 struct triangle
 {
 	vec3d p[3]; //Points
 	vec2d t[3]; //Texture coords
-	vec3d vn[3];//Vertex normals	//TODO: copy between triangles in render pipeline; interpolate where the triangles are clipped
+	vec3d vn[3];//Vertex normals, only used to bake the lighting
+	Pixel light[3]; //Baked lighting at each point, white is fully lit
+	vec3d shadow[3]; //Position of each point in the shadow map
 	int matIndex;
 	
 	triangle(int matIndex = 0,
 			 const vec3d &p1 = vec3d(), const vec3d &p2 = vec3d(), const vec3d &p3 = vec3d(),
 			 const vec2d &t1 = vec2d(), const vec2d &t2 = vec2d(), const vec2d &t3 = vec2d(),
 			 const vec3d &n1 = vec3d(), const vec3d &n2 = vec3d(), const vec3d &n3 = vec3d())
-		: p{ p1, p2, p3 }, t{ t1, t2, t3 }, vn{ n1, n2, n3 }, matIndex(matIndex)
+		: p{ p1, p2, p3 }, t{ t1, t2, t3 }, vn{ n1, n2, n3 }, light{ WHITE, WHITE, WHITE }, matIndex(matIndex)
 	{}
 
 	Pixel SampleCol(float u, float v) //TODO ?
@@ -313,11 +538,21 @@ struct mesh
 {
 	string name;
 	vector<triangle> tris;
+	vector<vec3d> verts; //Each corner position once, however many triangles share it
+	vector<int> indices; //Three per triangle, into verts. Empty for meshes made without them, which are drawn from their triangles' own points
 	vec3d position;
 	vec3d rotation;
 	int modifier;
 	//vec3d scale; //TODO
 
+	//Bounding sphere around the untransformed vertices, for culling whole meshes
+	vec3d boundsCenter;
+	float boundsRadius = 0.0f;
+	bool fogCullable = true; //False if any of its materials ignore fog
+	bool sky = false; //Made entirely of sky materials; the sky is drawn per pixel instead
+	bool moves = false; //Has a modifier, or is parented to a mesh that moves; everything else is drawn and shadowed once
+	quaternion pathRotation; //Which way it last faced along the path it follows
+
 	void setPos(vec3d& pos)
 	{
 		this->position = pos;
@@ -331,17 +566,54 @@ struct mesh
 	mesh(string meshName)
 		: name(meshName), tris{}, position(vec3d()), rotation(vec3d()), modifier(-1)
 	{}
+
+	void calculateBounds()
+	{
+		if (tris.empty())
+		{
+			return;
+		}
+
+		vec3d lo = tris[0].p[0], hi = tris[0].p[0];
+		for (triangle& tri : tris)
+		{
+			for (int v = 0; v < 3; v++)
+			{
+				lo = vec3d(fmin(lo.x, tri.p[v].x), fmin(lo.y, tri.p[v].y), fmin(lo.z, tri.p[v].z));
+				hi = vec3d(fmax(hi.x, tri.p[v].x), fmax(hi.y, tri.p[v].y), fmax(hi.z, tri.p[v].z));
+			}
+		}
+
+		boundsCenter = (lo + hi) * 0.5f;
+		boundsRadius = 0.0f;
+		for (triangle& tri : tris)
+		{
+			for (int v = 0; v < 3; v++)
+			{
+				boundsRadius = fmax(boundsRadius, (tri.p[v] - boundsCenter).length());
+			}
+		}
+	}
 };
 
+enum class textureFilter { NEAREST, BILINEAR };
+enum class alphaMode { AUTO, BLEND, CUTOUT };
+
 struct material
 {
 	int textureIndex;
 	int alphaIndex;
+	int sequenceIndex; //Streamed image sequence, used in place of textureIndex
 	Pixel col;
-	Pixel emis;
+	Pixel emis; //Emissive colour, glows through bloom
 	float metallic;
 
 	float mipScale = 1.0f;
+	textureFilter filter = textureFilter::NEAREST;
+	alphaMode transparency = alphaMode::AUTO; //How map_d is drawn
+	bool lit = true; //False for illum 0, and for emissive materials
+	bool fog = true; //False for things like the skybox, that should stay visible however far away they are
+	bool sky = false; //The background, looked up by view direction rather than drawn as geometry
 
 	//Animation stuff
 	int startIndex, endIndex; //Indexed from 0
@@ -350,9 +622,14 @@ struct material
 
 	//Default material will just be a solid white, no texture
 	material(int textureIndex = -1, int alphaIndex = -1)
-		: textureIndex(textureIndex), alphaIndex(alphaIndex), col(WHITE), metallic(0),
+		: textureIndex(textureIndex), alphaIndex(alphaIndex), sequenceIndex(-1), col(WHITE), emis(BLACK), metallic(0),
 		  startIndex(0), endIndex(0), xDivisions(1), yDivisions(1), animSpeed(0.0f)
 	{}
+
+	bool isEmissive() const
+	{
+		return emis.r != 0 || emis.g != 0 || emis.b != 0;
+	}
 };
 
 
@@ -383,6 +660,9 @@ struct texture
 {
 	int numMips = 5;
 	Sprite** mips;
+	shared_ptr<Sprite*> ownedMips; //Shared by every copy of the texture, so the mips are freed along with the last one
+	bool opaque = false; //No texels below half alpha, so every texel drawn can occlude
+	bool binaryAlpha = false; //Next to no texels partly transparent, so it can be drawn as a cut-out instead of blended
 	//const float mipDist;
 
 	texture()
@@ -390,9 +670,12 @@ struct texture
 	{}
 
 	texture(int numMips)
-		: numMips(numMips), mips( new Sprite*[numMips] )
-	{}
+		: numMips(numMips), mips( new Sprite*[numMips]() )
+	{
+		OwnMips();
+	}
 
+	//Takes ownership of the sprites
 	texture(int numMips, Sprite* mips[])
 		: numMips(numMips), mips( new Sprite*[numMips] )
 	{
@@ -400,19 +683,25 @@ struct texture
 		{
 			this->mips[m] = mips[m];
 		}
+		OwnMips();
 	}
 
 	//Generates mips automatically, expects a square texture
 	texture(Sprite* sprite)
 	{
-		numMips = min(4, (int)ceil(log2(sprite->width))); //Number of mips is based on the texture size,
-												 //the number of times the image can be halved
+		numMips = max(1, min(4, (int)ceil(log2(sprite->width)))); //Number of mips is based on the texture size,
+														  //the number of times the image can be halved; a 1x1 texture still has itself
 
-		mips = new Sprite*[numMips]; //If this broke there's probably something wrong with the file path in the .mtl file
+		mips = new Sprite*[numMips](); //If this broke there's probably something wrong with the file path in the .mtl file
 
 		mips[0] = sprite;
+		OwnMips();
 		mips[0]->SetSampleMode(Sprite::Mode::PERIODIC);
 
+		opaque = all_of(sprite->pColData.begin(), sprite->pColData.end(), [](const Pixel& p) { return p.a >= 128; });
+		size_t partlyClear = count_if(sprite->pColData.begin(), sprite->pColData.end(), [](const Pixel& p) { return p.a > 16 && p.a < 240; });
+		binaryAlpha = partlyClear <= sprite->pColData.size() / 64;
+
 		//Generate mips, each one is half the size of the previous
 		for (int m = 1; m < numMips; m++)
 		{
@@ -423,11 +712,19 @@ struct texture
 		}
 	}
 
-	~texture()
+private:
+	void OwnMips()
 	{
-		//delete mips;
+		int n = numMips;
+		ownedMips = shared_ptr<Sprite*>(mips, [n](Sprite** mips)
+		{
+			for (int m = 0; m < n; m++)
+			{
+				delete mips[m];
+			}
+			delete[] mips;
+		});
 	}
-
 };
 
 //Modifies properties of an entire mesh
@@ -486,6 +783,10 @@ struct path
 	vector<vec3d> pts;
 	vector<infoPoint> infoPts;
 
+	//Distance along the path at the previous simulation step, and the distance being drawn, between that and the current step
+	float prevLength = 0.0f;
+	float drawLength = 0.0f;
+
 	//Freezeframe slow-mo effect when at important points
 
 	path(string name, float x = 0.0f, float y = 0.0f, float z = 0.0f)
@@ -498,6 +799,9 @@ struct path
 		currInfoPt = 0;
 		posT = 0.0f;
 		isMoving = false;
+
+		//Jump straight back to the start, rather than being drawn sliding there
+		prevLength = drawLength = getStepLength();
 	}
 
 	void Next()
@@ -553,7 +857,7 @@ struct path
 
 			if (posT >= 0.5f) //Display current info point
 			{
-				infoPts[currInfoPt].alpha = infoPts[currInfoPt].alpha >= 1.0f ? 1.0f : infoPts[currInfoPt].alpha + 0.01f;
+				infoPts[currInfoPt].alpha = min(1.0f, infoPts[currInfoPt].alpha + 0.6f * fElapsedTime);
 			}
 			if (posT >= 1.0f) //Reached next point, stop moving
 			{
@@ -586,73 +890,237 @@ struct path
 		}
 	}
 
-	vec3d getCurrPosition(float offset = 0.0f)
+	//Distance along the path that Update() has got to
+	float getStepLength()
 	{
-		if (infoPts.size() == 0)
+		BuildCurve();
+		if (infoPts.size() == 0 || arcLengths.empty())
 		{
-			return pts[0];
+			return 0.0f;
 		}
 
-		//return getLerpPointBetween(infoPts[currInfoPt - 1].pathPtIndex, infoPts[currInfoPt].pathPtIndex, posT, offset);
-
-		if (isMoving) //Get intermediary point, between 2 info points
+		float endLen = arcLengths[infoPts[currInfoPt].pathPtIndex * arcSamples];
+		if (isMoving) //Between 2 info points
 		{
-			return getLerpPointBetween(infoPts[currInfoPt - 1].pathPtIndex, infoPts[currInfoPt].pathPtIndex, posT, offset);
-		}
-		else //Get exact info point on the path
-		{
-			return pts[infoPts[currInfoPt].pathPtIndex + trunc(offset)];
+			float startLen = arcLengths[infoPts[currInfoPt - 1].pathPtIndex * arcSamples];
+			return startLen + max(0.0f, min(1.0f, posT)) * (endLen - startLen);
 		}
+		return endLen;
+	}
+
+	//Call before each Update(), to keep where the path was for Interpolate()
+	void BeginStep()
+	{
+		prevLength = getStepLength();
+	}
+
+	//Sets where the path is drawn, between where it was before the last Update() (0) and where it is now (1)
+	void Interpolate(float alpha)
+	{
+		drawLength = prevLength + (getStepLength() - prevLength) * alpha;
+	}
+
+	//Position along the path, as last interpolated; offset is in path points, and can be fractional
+	//tangent, if given, gets the direction the path is heading there, in units per path point
+	vec3d getCurrPosition(float offset = 0.0f, vec3d* tangent = nullptr)
+	{
+		return getPointAtParam(getParamAtLength(drawLength) + offset, tangent);
 	}
 
-	//Lerps along the path; 0.0f < t < 1.0f
+	//Position along the path that Update() has got to, without interpolation
+	vec3d getStepPosition()
+	{
+		return getPointAtParam(getParamAtLength(getStepLength()));
+	}
+
+	//Moves along the whole path at an even speed; 0.0f < t < 1.0f
 	vec3d getLerpPoint(float t, bool reversed = false)
 	{
 		return getLerpPointBetween(0, pts.size() - 1, t, 0.0f, reversed);
 	}
 
-	//Lerps between 2 points along the path; 0.0f < t < 1.0f
-	vec3d getLerpPointBetween(int indexA, int indexB, float t, float offset = 0.0f, bool reversed = false)
+	//Moves between 2 points along the path at an even speed, whatever the spacing of the points between; 0.0f < t < 1.0f
+	//offset is in path points, from wherever t lands
+	vec3d getLerpPointBetween(int indexA, int indexB, float t, float offset = 0.0f, bool reversed = false, vec3d* tangent = nullptr)
 	{
-		if (offset != 0.0f)
+		if (pts.size() < 2)
 		{
-			//TODO: Fix - Only works with whole numbers for offset
-			//t += offset/(indexB - indexA);
-
-			t += offset;
-			int ptOffset = trunc(t);
-			t -= ptOffset;
-			
-			indexA += ptOffset;
-			indexB += ptOffset;
+			return getPointAtParam(0.0f, tangent);
 		}
-
+		BuildCurve();
 
 		t = max(0.0f, min(1.0f, t));
 		indexA = max(0, min((int)pts.size()-1, indexA));
 		indexB = max(0, min((int)pts.size()-1, indexB));
 
-
 		if (reversed)
 		{
 			t = 1.0f - t;
 		}
 
-		if (t == 0.0f)
+		float startLen = arcLengths[indexA * arcSamples];
+		float len = startLen + t * (arcLengths[indexB * arcSamples] - startLen);
+		return getPointAtParam(getParamAtLength(len) + offset, tangent);
+	}
+
+	//Total length of the curve through the points
+	float getLength()
+	{
+		BuildCurve();
+		return arcLengths.empty() ? 0.0f : arcLengths.back();
+	}
+
+	//Point a distance along the curve from its start
+	vec3d getPointAtLength(float len, vec3d* tangent = nullptr)
+	{
+		BuildCurve();
+		return getPointAtParam(getParamAtLength(len), tangent);
+	}
+
+	//Points at many distances along the curve at once, as fractions of its length (0-1)
+	//Ascending fractions (as when drawing the curve) only search the part of the table after the last one
+	void getPointsAlong(const vector<float>& fractions, vector<vec3d>& out, vector<vec3d>* tangents = nullptr)
+	{
+		BuildCurve();
+		out.resize(fractions.size());
+		if (tangents)
+		{
+			tangents->resize(fractions.size());
+		}
+
+		float total = getLength();
+		size_t from = 0;
+		float prev = -INFINITY;
+		for (size_t i = 0; i < fractions.size(); i++)
+		{
+			float len = max(0.0f, min(1.0f, fractions[i])) * total;
+			if (len < prev)
+			{
+				from = 0;
+			}
+			prev = len;
+
+			float param = getParamAtLength(len, from);
+			out[i] = getPointAtParam(param, tangents ? &(*tangents)[i] : nullptr);
+		}
+	}
+
+	//Drops the curve, so it is fitted again to the points the next time it is needed
+	void InvalidateCurve()
+	{
+		segments.clear();
+		arcLengths.clear();
+	}
+
+private:
+	//Centripetal Catmull-Rom curve through the points, as one cubic per segment: c0 + c1*u + c2*u^2 + c3*u^3, 0 <= u <= 1
+	//Centripetal, so it doesn't loop or overshoot where the points are unevenly spaced
+	struct segment
+	{
+		vec3d c0, c1, c2, c3;
+	};
+	vector<segment> segments;
+
+	//Distance along the curve at arcSamples evenly spaced values of u per segment, and at the very end
+	//So arcLengths[i * arcSamples] is the distance to pts[i]
+	static const int arcSamples = 8;
+	vector<float> arcLengths;
+
+	void BuildCurve()
+	{
+		if (!arcLengths.empty() || pts.size() < 2)
+		{
+			return;
+		}
+
+		int n = (int)pts.size();
+		segments.resize(n - 1);
+		for (int i = 0; i < n - 1; i++)
 		{
-			//return pts[indexB];
+			//Ends are extended straight out, as if there were a point mirrored beyond them
+			vec3d p0 = i > 0 ? pts[i - 1] : pts[0] * 2.0f - pts[1];
+			vec3d p1 = pts[i];
+			vec3d p2 = pts[i + 1];
+			vec3d p3 = i + 2 < n ? pts[i + 2] : pts[n - 1] * 2.0f - pts[n - 2];
+
+			//Knot spacing is the square root of the distance between points; repeated points are given some anyway
+			float dt0 = sqrtf((p1 - p0).length()), dt1 = sqrtf((p2 - p1).length()), dt2 = sqrtf((p3 - p2).length());
+			dt1 = dt1 < 1e-4f ? 1.0f : dt1;
+			dt0 = dt0 < 1e-4f ? dt1 : dt0;
+			dt2 = dt2 < 1e-4f ? dt1 : dt2;
+
+			//Tangents at p1 and p2 over the non-uniform knots, then scaled to u going 0-1 over the segment
+			vec3d t1 = ((p1 - p0) / dt0 - (p2 - p0) / (dt0 + dt1) + (p2 - p1) / dt1) * dt1;
+			vec3d t2 = ((p2 - p1) / dt1 - (p3 - p1) / (dt1 + dt2) + (p3 - p2) / dt2) * dt1;
+
+			segment& sg = segments[i];
+			sg.c0 = p1;
+			sg.c1 = t1;
+			sg.c2 = p1 * -3.0f + p2 * 3.0f - t1 * 2.0f - t2;
+			sg.c3 = p1 * 2.0f - p2 * 2.0f + t1 + t2;
 		}
-		else if (t == 1.0f)
+
+		arcLengths.resize((n - 1) * arcSamples + 1);
+		arcLengths[0] = 0.0f;
+		vec3d prev = pts[0];
+		for (int k = 1; k < (int)arcLengths.size(); k++)
+		{
+			vec3d p = getPointAtParam((float)k / arcSamples);
+			arcLengths[k] = arcLengths[k - 1] + (p - prev).length();
+			prev = p;
+		}
+	}
+
+	//Curve parameter (path point index plus u) at a distance along it, searching the table from an entry onwards
+	float getParamAtLength(float len, size_t& from)
+	{
+		if (arcLengths.empty())
 		{
-			//return pts[indexA];
+			return 0.0f;
 		}
+		len = max(0.0f, min(arcLengths.back(), len));
 
-		//2 to 4, 0.7			2
-		float x = t * (indexB - indexA); //1.4
-		int nearestLower = indexA + floor(x); //3
-		int nearestHigher = nearestLower + 1; //4
-		float ptT = fmodf(x, 1); //Extract decimal places
+		auto it = upper_bound(arcLengths.begin() + from, arcLengths.end(), len);
+		int k = max(1, min((int)arcLengths.size() - 1, (int)(it - arcLengths.begin())));
+		from = k - 1;
 
-		return pts[nearestLower].lerp(pts[nearestHigher], ptT);
+		float span = arcLengths[k] - arcLengths[k - 1];
+		float f = span > 0.0f ? (len - arcLengths[k - 1]) / span : 0.0f;
+		return (k - 1 + f) / arcSamples;
+	}
+
+	float getParamAtLength(float len)
+	{
+		size_t from = 0;
+		return getParamAtLength(len, from);
+	}
+
+	//One cubic, at a curve parameter (path point index plus u), clamped to the ends of the path
+	vec3d getPointAtParam(float param, vec3d* tangent = nullptr)
+	{
+		if (pts.empty())
+		{
+			return vec3d();
+		}
+		BuildCurve();
+		if (segments.empty())
+		{
+			if (tangent)
+			{
+				*tangent = vec3d(0, 0, 0);
+			}
+			return pts[0];
+		}
+
+		param = max(0.0f, min((float)segments.size(), param));
+		int i = min((int)segments.size() - 1, (int)param);
+		float u = param - i;
+
+		const segment& sg = segments[i];
+		if (tangent)
+		{
+			*tangent = sg.c1 + sg.c2 * (2.0f * u) + sg.c3 * (3.0f * u * u);
+		}
+		return sg.c0 + (sg.c1 + (sg.c2 + sg.c3 * u) * u) * u;
 	}
 };
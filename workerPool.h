@@ -0,0 +1,144 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+//A fixed set of threads that split loops over rows (or anything else indexable) between them
+//The threads are kept around and woken per job, since starting threads every frame costs more than the work itself
+class WorkerPool
+{
+private:
+	vector<thread> workers;
+	mutex m;
+	condition_variable wake, done;
+	bool quit = false;
+
+	//Current job
+	const function<void(int, int)>* job = nullptr;
+	int jobCount = 0, numChunks = 0;
+	unsigned int generation = 0; //Bumped for every job, so sleeping workers can tell a new one has arrived
+	atomic<unsigned long long> nextChunk{ 0 }; //The job's generation in the top 32 bits, the next chunk to hand out in the bottom 32
+	int chunksLeft = 0;
+
+	//Takes chunks of a job until there are none left. The job is passed in as it was when read under the lock, and chunks are only
+	//taken while the counter still belongs to its generation, so a worker late to finish one job can never take part of the next
+	void RunChunks(const function<void(int, int)>* fn, int count, int chunks, unsigned int gen)
+	{
+		unsigned long long claim = nextChunk.load();
+		while ((unsigned int)(claim >> 32) == gen && (int)(claim & 0xFFFFFFFF) < chunks)
+		{
+			if (!nextChunk.compare_exchange_weak(claim, claim + 1))
+			{
+				continue; //Someone else took it; claim now holds the counter's new value
+			}
+
+			int chunk = (int)(claim & 0xFFFFFFFF);
+			int begin = (int)((long long)count * chunk / chunks);
+			int end = (int)((long long)count * (chunk + 1) / chunks);
+			(*fn)(begin, end);
+
+			{
+				lock_guard<mutex> lock(m);
+				if (--chunksLeft == 0)
+				{
+					done.notify_all();
+				}
+			}
+			claim = nextChunk.load();
+		}
+	}
+
+	void WorkerLoop()
+	{
+		unsigned int seen = 0;
+		unique_lock<mutex> lock(m);
+
+		while (true)
+		{
+			wake.wait(lock, [&] { return quit || generation != seen; });
+			if (quit)
+			{
+				return;
+			}
+			seen = generation;
+
+			const function<void(int, int)>* fn = job;
+			int count = jobCount, chunks = numChunks;
+			lock.unlock();
+			RunChunks(fn, count, chunks, seen);
+			lock.lock();
+		}
+	}
+
+public:
+	//By default, one worker for every hardware thread besides the calling one
+	WorkerPool(int numThreads = -1)
+	{
+		if (numThreads < 0)
+		{
+			numThreads = max(0, (int)thread::hardware_concurrency() - 1);
+		}
+		for (int i = 0; i < numThreads; i++)
+		{
+			workers.push_back(thread(&WorkerPool::WorkerLoop, this));
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+
+	~WorkerPool()
+	{
+		{
+			lock_guard<mutex> lock(m);
+			quit = true;
+		}
+		wake.notify_all();
+		for (thread& t : workers)
+		{
+			t.join();
+		}
+	}
+
+	int NumThreads() const
+	{
+		return (int)workers.size() + 1;
+	}
+
+	//Calls fn(begin, end) over ranges covering [0, count), and returns once all of them have finished
+	//The calling thread works on the job too. Jobs smaller than minPerThread aren't worth waking anyone for
+	void ParallelFor(int count, const function<void(int begin, int end)>& fn, int minPerThread = 1)
+	{
+		int chunks = min(NumThreads(), count / max(1, minPerThread));
+		if (chunks <= 1)
+		{
+			if (count > 0)
+			{
+				fn(0, count);
+			}
+			return;
+		}
+
+		unsigned int gen;
+		{
+			lock_guard<mutex> lock(m);
+			job = &fn;
+			jobCount = count;
+			numChunks = chunks;
+			chunksLeft = chunks;
+			gen = ++generation;
+			nextChunk = (unsigned long long)gen << 32;
+		}
+		wake.notify_all();
+
+		RunChunks(&fn, count, chunks, gen);
+
+		unique_lock<mutex> lock(m);
+		done.wait(lock, [&] { return chunksLeft == 0; });
+		job = nullptr;
+	}
+};